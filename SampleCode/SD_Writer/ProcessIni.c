@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "fmi.h"
 #include "writer.h"
 
 #include "ff.h"
@@ -110,6 +111,61 @@ int Convert(char *Data)
     return value;
 }
 
+/* optional fields of a [DataN] line after the address, in any order:
+   image type data (default), raw, ubi or yaffs2, and the partition size 0x... */
+static void ImageOption(char *Cmd, INI_USER_IMAGE_T *pImage)
+{
+    char *ptr, size[256];
+
+    pImage->ImageType = IMAGE_DATA;
+    pImage->PartSize = 0;
+    ptr = strchr(Cmd, ',');
+    if (ptr != NULL)
+        ptr = strchr(ptr+1, ',');
+    while (ptr != NULL) {
+        while (*(++ptr) == ' ');
+        if (strncmp(ptr, "raw", 3) == 0)
+            pImage->ImageType = IMAGE_RAW;
+        else if (strncmp(ptr, "ubi", 3) == 0)
+            pImage->ImageType = IMAGE_UBI;
+        else if (strncmp(ptr, "yaffs2", 6) == 0)
+            pImage->ImageType = IMAGE_YAFFS2;
+        else if (sscanf(ptr, "0x%[0-9a-fA-F]", size) == 1)
+            pImage->PartSize = Convert(size);
+        ptr = strchr(ptr, ',');
+    }
+}
+
+/* [Format] Part=<name>, <size in MB>[, fat|linux|swap], one GPT partition per line
+   in disk order. Size 0 takes the rest of the device, type defaults to linux. */
+static void PartOption(char *Cmd)
+{
+    FW_MMC_PART_T *pPart;
+    char *ptr;
+    int size = 0;
+
+    if (Ini_Writer.EMMC_Format.PartCount >= MMC_MAX_PART)
+        return;
+    pPart = &Ini_Writer.EMMC_Format.Part[Ini_Writer.EMMC_Format.PartCount];
+    memset(pPart, 0, sizeof(FW_MMC_PART_T));
+    if (sscanf(Cmd, "%35[^,], %d", pPart->Name, &size) != 2)
+        return;
+    pPart->Size = size;
+    pPart->Type = MMC_PART_LINUX;
+    ptr = strchr(Cmd, ',');
+    ptr = strchr(ptr+1, ',');
+    if (ptr != NULL) {
+        while (*(++ptr) == ' ');
+        if (strncmp(ptr, "fat", 3) == 0)
+            pPart->Type = MMC_PART_FAT;
+        else if (strncmp(ptr, "swap", 4) == 0)
+            pPart->Type = MMC_PART_SWAP;
+    }
+    Ini_Writer.EMMC_Format.PartCount++;
+    Ini_Writer.EMMC_Format.GPT = 1;
+    Ini_Writer.EMMC_Format.user_choice = 1;
+}
+
 FIL File_Obj;        /* File objects */
 
 /*-----------------------------------------------------------------------------
@@ -128,6 +184,23 @@ int ProcessINI(char *fileName)
     Ini_Writer.Loader.FileName[0] = 0;
     Ini_Writer.Erase.user_choice = 0;
     Ini_Writer.Erase.EraseAll = 0;
+    Ini_Writer.SpiNand.user_choice = 0;
+    Ini_Writer.SpiNand.BBM_LUT = 0;
+    Ini_Writer.SpiNand.LUTSpare = 20;
+    Ini_Writer.SpiNand.Verify = 0;
+    Ini_Writer.SpiNand.ScrubThreshold = 0;
+    Ini_Writer.SpiNand.BootCopies = 4;
+    Ini_Writer.Nand.user_choice = 0;
+    Ini_Writer.Nand.Verify = 0;
+    Ini_Writer.Nand.BitflipThreshold = 0;
+    Ini_Writer.Nand.BootCopies = 4;
+    Ini_Writer.Emmc.user_choice = 0;
+    Ini_Writer.Emmc.BootPartition = 0;
+    Ini_Writer.Emmc.BootUser = 0;
+    Ini_Writer.Emmc.SkipSame = 0;
+    Ini_Writer.EMMC_Format.user_choice = 0;
+    Ini_Writer.EMMC_Format.GPT = 0;
+    Ini_Writer.EMMC_Format.PartCount = 0;
 
     for(i=0; i<MAX_USER_IMAGE; i++) {
         Ini_Writer.UserImage[i].FileName[0] = 0;
@@ -240,9 +313,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -261,9 +335,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -282,9 +357,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -303,9 +379,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -324,9 +401,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -345,9 +423,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -366,9 +445,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -387,9 +467,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -408,9 +489,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -429,9 +511,10 @@ NextMark2:
                 else if (Cmd[0] == '[')
                     goto NextMark2; /* use default value since no assign value before next keyword */
                 else {
-                    sscanf (Cmd,"%[^,], 0x%s",filename, block);
+                    sscanf (Cmd,"%[^,], 0x%[0-9a-fA-F]",filename, block);
                     strcpy(Ini_Writer.UserImage[u32UserImageCount].FileName, filename);
                     Ini_Writer.UserImage[u32UserImageCount].address = Convert(block);
+                    ImageOption(Cmd, &Ini_Writer.UserImage[u32UserImageCount]);
                     Ini_Writer.UserImage[u32UserImageCount].user_choice = 1;
                     u32ImageCount++;
                     u32UserImageCount++;
@@ -472,8 +555,12 @@ NextMark2:
                 else {
                     if (sscanf (Cmd,"ReservedSpace=%d, PartitionNum=%d, PartitionS1Size=%d, PartitionS2Size=%d, PartitionS3Size=%d, PartitionS4Size=%d",&(Ini_Writer.EMMC_Format.ReservedSpace), &(Ini_Writer.EMMC_Format.PartitionNum), &(Ini_Writer.EMMC_Format.Partition1Size), &(Ini_Writer.EMMC_Format.Partition2Size), &(Ini_Writer.EMMC_Format.Partition3Size), &(Ini_Writer.EMMC_Format.Partition4Size)) == 6)
                         Ini_Writer.EMMC_Format.user_choice = 1;
-
-                    break;
+                    /* one option per line, keep reading until the next keyword */
+                    if (sscanf (Cmd,"GPT=%d",&(Ini_Writer.EMMC_Format.GPT)) == 1)
+                        Ini_Writer.EMMC_Format.user_choice = 1;
+                    if (strncmp(Cmd, "Part=", 5) == 0)
+                        PartOption(Cmd + 5);
+                    continue;
                 }
             } while (1);
         } else if (strcmp(Cmd, "[Erase]") == 0) {
@@ -495,6 +582,82 @@ NextMark2:
                     break;
                 }
             } while (1);
+        } else if (strcmp(Cmd, "[SPINAND]") == 0) {
+            do {
+                status = readLine(&File_Obj, Cmd);
+                if (status < 0)
+                    break;          /* use default value since error code from FAT. Coulde be end of file. */
+                else if (Cmd[0] == 0)
+                    continue;       /* skip empty line */
+                else if ((Cmd[0] == '/') && (Cmd[1] == '/'))
+                    continue;       /* skip comment line */
+                else if (Cmd[0] == '[')
+                    goto NextMark2; /* use default value since no assign value before next keyword */
+                else {
+                    /* one option per line, keep reading until the next keyword */
+                    if (sscanf (Cmd,"BBM_LUT=%d",&(Ini_Writer.SpiNand.BBM_LUT)) == 1)
+                        Ini_Writer.SpiNand.user_choice = 1;
+                    if (sscanf (Cmd,"LUTSpare=%d",&(Ini_Writer.SpiNand.LUTSpare)) == 1)
+                        Ini_Writer.SpiNand.user_choice = 1;
+                    if (sscanf (Cmd,"Verify=%d",&(Ini_Writer.SpiNand.Verify)) == 1)
+                        Ini_Writer.SpiNand.user_choice = 1;
+                    if (sscanf (Cmd,"ScrubThreshold=%d",&(Ini_Writer.SpiNand.ScrubThreshold)) == 1)
+                        Ini_Writer.SpiNand.user_choice = 1;
+                    if (sscanf (Cmd,"BootCopies=%d",&(Ini_Writer.SpiNand.BootCopies)) == 1) {
+                        if (Ini_Writer.SpiNand.BootCopies < 1)
+                            Ini_Writer.SpiNand.BootCopies = 1;
+                        Ini_Writer.SpiNand.user_choice = 1;
+                    }
+                    continue;
+                }
+            } while (1);
+        } else if (strcmp(Cmd, "[NAND]") == 0) {
+            do {
+                status = readLine(&File_Obj, Cmd);
+                if (status < 0)
+                    break;          /* use default value since error code from FAT. Coulde be end of file. */
+                else if (Cmd[0] == 0)
+                    continue;       /* skip empty line */
+                else if ((Cmd[0] == '/') && (Cmd[1] == '/'))
+                    continue;       /* skip comment line */
+                else if (Cmd[0] == '[')
+                    goto NextMark2; /* use default value since no assign value before next keyword */
+                else {
+                    /* one option per line, keep reading until the next keyword */
+                    if (sscanf (Cmd,"Verify=%d",&(Ini_Writer.Nand.Verify)) == 1)
+                        Ini_Writer.Nand.user_choice = 1;
+                    if (sscanf (Cmd,"BitflipThreshold=%d",&(Ini_Writer.Nand.BitflipThreshold)) == 1)
+                        Ini_Writer.Nand.user_choice = 1;
+                    if (sscanf (Cmd,"BootCopies=%d",&(Ini_Writer.Nand.BootCopies)) == 1) {
+                        if (Ini_Writer.Nand.BootCopies < 1)
+                            Ini_Writer.Nand.BootCopies = 1;
+                        Ini_Writer.Nand.user_choice = 1;
+                    }
+                    continue;
+                }
+            } while (1);
+        } else if (strcmp(Cmd, "[eMMC]") == 0) {
+            do {
+                status = readLine(&File_Obj, Cmd);
+                if (status < 0)
+                    break;          /* use default value since error code from FAT. Coulde be end of file. */
+                else if (Cmd[0] == 0)
+                    continue;       /* skip empty line */
+                else if ((Cmd[0] == '/') && (Cmd[1] == '/'))
+                    continue;       /* skip comment line */
+                else if (Cmd[0] == '[')
+                    goto NextMark2; /* use default value since no assign value before next keyword */
+                else {
+                    /* one option per line, keep reading until the next keyword */
+                    if (sscanf (Cmd,"BootPartition=%d",&(Ini_Writer.Emmc.BootPartition)) == 1)
+                        Ini_Writer.Emmc.user_choice = 1;
+                    if (sscanf (Cmd,"BootUser=%d",&(Ini_Writer.Emmc.BootUser)) == 1)
+                        Ini_Writer.Emmc.user_choice = 1;
+                    if (sscanf (Cmd,"SkipSame=%d",&(Ini_Writer.Emmc.SkipSame)) == 1)
+                        Ini_Writer.Emmc.user_choice = 1;
+                    continue;
+                }
+            } while (1);
         }
     } while (status >= 0);  /* keep parsing INI file */
 
@@ -22,7 +22,6 @@ extern void SendAck(UINT32 status);
 #define MSG_DEBUG       printf
 
 #define SectorSize 512
-#define WriteLen  512
 static UINT8 bpb_sample[]= {
     0xEB, 0x58, 0x90, 0x4D, 0x53, 0x44, 0x4F, 0x53, 0x35, 0x2E, 0x30, 0x00, 0x02, 0x08, 0x22, 0x00,
     0x02, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x00, 0x00, 0x3F, 0x00, 0xFF, 0x00, 0x3F, 0x00, 0x00, 0x00,
@@ -232,191 +231,385 @@ PMBR create_mbr(UINT32 TotalSize, FW_MMC_IMAGE_T *myPmmcImage)
     return mbr;
 }
 
-INT32 FormatFat32(PMBR pmbr,UINT32 nCount)
+/*
+ * GUID partition table. The header stays at LBA 1 as the UEFI spec requires,
+ * but the entry array is placed behind the reserved space instead of LBA 2,
+ * where the boot ROM expects the loader (0x400). The reserved space has to
+ * hold at least the loader area, or the next loader burn would overwrite the
+ * entries. Partitions follow on 1 MB bounds.
+ * The backup array and header sit at the end of the device. The protective
+ * MBR and header, the entry array and the backup are assembled in MBR_BUFFER
+ * and written with one transfer each.
+ */
+#define GPT_ENTRY_NUM       128
+#define GPT_ENTRY_SIZE      128
+#define GPT_ENTRY_SECTORS   (GPT_ENTRY_NUM * GPT_ENTRY_SIZE / SectorSize)
+#define GPT_ALIGN           2048        /* sectors, 1 MB */
+#define GPT_LOADER_SECTORS  2048        /* sectors from LBA 0 kept for the loader */
+
+/* type GUIDs in on-disk byte order */
+static const UINT8 gpt_type_guid[3][16] = {
+    /* MMC_PART_FAT: EBD0A0A2-B9E5-4433-87C0-68B6B72699C7 */
+    { 0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44, 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 },
+    /* MMC_PART_LINUX: 0FC63DAF-8483-4772-8E79-3D69D8477DE4 */
+    { 0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47, 0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4 },
+    /* MMC_PART_SWAP: 0657FD6D-A4AB-43C4-84E5-0933C84B4F4F */
+    { 0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43, 0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F },
+};
+
+static UINT32 gpt_crc32(UINT32 crc, UINT8 *buf, UINT32 len)
+{
+    int i;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/* random (version 4) GUID, seeded from the timer, the device size and the index */
+static void gpt_guid(UINT8 *guid, UINT32 seed)
+{
+    UINT32 val, tick;
+    int i;
+
+    val = gpt_crc32(0, (UINT8 *)&seed, 4);
+    for (i = 0; i < 16; i += 4) {
+        tick = get_timer_ticks();
+        val = gpt_crc32(val, (UINT8 *)&tick, 4);
+        PUT32_L(guid,i,val);
+    }
+    guid[7] = (guid[7] & 0x0F) | 0x40;
+    guid[8] = (guid[8] & 0x3F) | 0x80;
+}
+
+static void gpt_header(UINT8 *hdr, UINT32 uMyLBA, UINT32 uAltLBA, UINT32 uEntryLBA,
+                       UINT32 uFirstUsable, UINT32 uLastUsable, UINT8 *guid, UINT32 uEntryCRC)
+{
+    UINT32 crc;
+
+    memset(hdr, 0, SectorSize);
+    memcpy(hdr, "EFI PART", 8);
+    PUT32_L(hdr,8,0x00010000);                  /* revision 1.0 */
+    PUT32_L(hdr,12,92);                         /* header size */
+    PUT32_L(hdr,24,uMyLBA);
+    PUT32_L(hdr,32,uAltLBA);
+    PUT32_L(hdr,40,uFirstUsable);
+    PUT32_L(hdr,48,uLastUsable);
+    memcpy(hdr+56, guid, 16);                   /* disk GUID */
+    PUT32_L(hdr,72,uEntryLBA);
+    PUT32_L(hdr,80,GPT_ENTRY_NUM);
+    PUT32_L(hdr,84,GPT_ENTRY_SIZE);
+    PUT32_L(hdr,88,uEntryCRC);
+    crc = gpt_crc32(0, hdr, 92);
+    PUT32_L(hdr,16,crc);
+}
+
+/*
+    TotalSize(sectors) : total sector size in the Device
+    myPmmcImage        : MMC struct, ReserveSize is kept free for the loader and images
+    pPart              : nCount partitions, FirstSector and SectorCount are filled in
+    return             : 0 on success, -1 if ReserveSize does not cover the loader area
+*/
+INT32 create_gpt(UINT32 TotalSize, FW_MMC_IMAGE_T *myPmmcImage, FW_MMC_PART_T *pPart, UINT32 nCount)
+{
+    UINT8  *pucBuf, *pucPmbr, *pucHdr, *pucEntry, *pucAlt, *pucPtr;
+    UINT8  diskguid[16];
+    UINT32 uEntryLBA, uFirstUsable, uLastUsable, uAltLBA, uStart, uSize, uEntryCRC;
+    UINT32 i, j;
+
+    if (myPmmcImage->ReserveSize < GPT_LOADER_SECTORS) {
+        printf("GPT: reserved space %d sectors, at least %d are needed for the loader\n",
+               myPmmcImage->ReserveSize, GPT_LOADER_SECTORS);
+        return -1;
+    }
+    if (nCount > GPT_ENTRY_NUM)
+        nCount = GPT_ENTRY_NUM;
+    pucBuf = (UINT8 *)(MBR_BUFFER | NON_CACHE);
+    pucPmbr = pucBuf;
+    pucHdr = pucBuf + SectorSize;
+    pucEntry = pucBuf + SectorSize * 2;
+    pucAlt = pucEntry + SectorSize * GPT_ENTRY_SECTORS;
+    memset(pucBuf, 0, SectorSize * (GPT_ENTRY_SECTORS + 3));
+
+    uEntryLBA = myPmmcImage->ReserveSize;
+    uFirstUsable = uEntryLBA + GPT_ENTRY_SECTORS;
+    uAltLBA = TotalSize - 1;
+    uLastUsable = uAltLBA - GPT_ENTRY_SECTORS - 1;
+
+    /* partition entries */
+    uStart = (uFirstUsable + GPT_ALIGN - 1) / GPT_ALIGN * GPT_ALIGN;
+    for (i = 0; i < nCount; i++) {
+        pucPtr = pucEntry + i * GPT_ENTRY_SIZE;
+        if (uStart > uLastUsable) {
+            printf("GPT: no space left for partition %d [%s]\n", i+1, pPart[i].Name);
+            break;
+        }
+        uSize = pPart[i].Size * 2 * 1024;
+        if ((uSize == 0) || (uSize > uLastUsable + 1 - uStart))
+            uSize = uLastUsable + 1 - uStart;
+        pPart[i].FirstSector = uStart;
+        pPart[i].SectorCount = uSize;
+
+        memcpy(pucPtr, gpt_type_guid[pPart[i].Type], 16);
+        gpt_guid(pucPtr+16, TotalSize+i+1);
+        PUT32_L(pucPtr,32,uStart);
+        PUT32_L(pucPtr,40,(uStart+uSize-1));
+        for (j = 0; (j < 36) && pPart[i].Name[j]; j++)
+            pucPtr[56+j*2] = pPart[i].Name[j];      /* UTF-16LE */
+        printf("GPT partition %d [%s]: sector %d, %d sectors\n", i+1, pPart[i].Name, uStart, uSize);
+
+        uStart = (uStart + uSize + GPT_ALIGN - 1) / GPT_ALIGN * GPT_ALIGN;
+    }
+    for (; i < nCount; i++)
+        pPart[i].SectorCount = 0;
+    uEntryCRC = gpt_crc32(0, pucEntry, GPT_ENTRY_NUM * GPT_ENTRY_SIZE);
+
+    /* primary and backup header */
+    gpt_guid(diskguid, TotalSize);
+    gpt_header(pucHdr, 1, uAltLBA, uEntryLBA, uFirstUsable, uLastUsable, diskguid, uEntryCRC);
+    gpt_header(pucAlt, uAltLBA, 1, uAltLBA - GPT_ENTRY_SECTORS, uFirstUsable, uLastUsable, diskguid, uEntryCRC);
+
+    /* protective MBR, one 0xEE partition over the whole device */
+    mbr = (PMBR)pucPmbr;
+    mbr->mbrPartition[0].pteStartSector = 0x02;
+    mbr->mbrPartition[0].pteSystemID = 0xEE;
+    mbr->mbrPartition[0].pteEndHead = 0xFF;
+    mbr->mbrPartition[0].pteEndSector = 0xFF;
+    mbr->mbrPartition[0].pteEndCylinder = 0xFF;
+    mbr->mbrPartition[0].pteFirstSector = 1;
+    mbr->mbrPartition[0].ptePartitionSize = TotalSize - 1;
+    mbr->mbrSignature = 0xAA55;
+
+    fmiSDWrite(0, 2, pucPmbr);
+    fmiSDWrite(uEntryLBA, GPT_ENTRY_SECTORS, pucEntry);
+    fmiSDWrite(uAltLBA - GPT_ENTRY_SECTORS, GPT_ENTRY_SECTORS + 1, pucEntry);
+    SendAck(10);
+    MSG_DEBUG("GPT: entries at %d, usable %d~%d, backup at %d\n", uEntryLBA, uFirstUsable, uLastUsable, uAltLBA);
+    return 0;
+}
+
+/*
+ * FAT formatter. Geometry is computed in closed form (Microsoft FAT spec):
+ * FAT16 below 260 MB, where FAT32 would have too few clusters, FAT32 above.
+ * Reserved sectors, both FATs and the root directory are one contiguous zero
+ * run, written from a zero region of ZeroLen sectors or skipped when the
+ * partition was trimmed on an eMMC that reads erased sectors as zero.
+ */
+#define ZeroLen             512                             /* sectors in the zero region */
+#define ZERO_BUFFER         (DOWNLOAD_BASE + 0x1000)
+#define FAT16_MIN_SECTORS   8400                            /* below: FAT12 */
+#define FAT32_MIN_SECTORS   532480                          /* 260 MB */
+
+static INT fsWriteZero(UINT32 uLogSecNo, UINT32 uCount)
+{
+    static BOOL bIsZeroReady = FALSE;
+    UINT8 *pucZero = (UINT8 *)((UINT32) ZERO_BUFFER | NON_CACHE);
+    UINT32 nWrtSecNum;
+    INT nStatus;
+
+    if (!bIsZeroReady) {
+        memset(pucZero, 0x0, 512*ZeroLen);
+        bIsZeroReady = TRUE;
+    }
+    while (uCount > 0) {
+        nWrtSecNum = MIN(ZeroLen, uCount);
+        nStatus = fmiSDWrite(uLogSecNo, nWrtSecNum, pucZero);
+        if (nStatus < 0)
+            return nStatus;
+        uLogSecNo += nWrtSecNum;
+        uCount -= nWrtSecNum;
+    }
+    return 0;
+}
+
+/* pmbr NULL: partition of a GPT, the protective MBR is left alone */
+static INT32 FormatFat(PMBR pmbr, PPTE pte)
 {
     UINT8  *pucSecBuff=NULL, *pucPtr;
     INT     nSecPerClus;
-    UINT32  uFatSize, uRsvSecNum=34, uRootClus=2;
-    UINT32  uData1, uData2;
-    UINT32  uLogSecNo;
-    INT     nWrtSecNum, nStatus;
+    UINT32  uFirst, uTotal, uFatSize, uRsvSecNum, uRootSecNum, uRootClus=2;
+    UINT32  uData1;
+    INT     nStatus;
+    BOOL    bIsFat16, bIsTrimmed;
     UINT8   FAT32Rsv[12] = { 0xF8, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0x0F };
-    UINT8   pucCode[] = { 0x04, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x0F,0xFF, 0xFF, 0xFF, 0x0F, 0xF8, 0xFF, 0xFF, 0x0F };
-    /*
-     * Clear Reserved sectors
-    */
+    UINT8   FAT16Rsv[4] = { 0xF8, 0xFF, 0xFF, 0xFF };
+
     pucSecBuff = (UINT8 *)((UINT32) DOWNLOAD_BASE | NON_CACHE);
+    pucPtr = pucSecBuff;
+    uFirst = pte->pteFirstSector;
+    uTotal = pte->ptePartitionSize;
+
+    /* determine the FAT type and cluster size */
+    bIsFat16 = (uTotal < FAT32_MIN_SECTORS) ? TRUE : FALSE;
+    if (bIsFat16) {
+        if (uTotal < FAT16_MIN_SECTORS) {
+            MSG_DEBUG("partition at %d: %d sectors, too small\n", uFirst, uTotal);
+            return -1;
+        }
+        if (uTotal <= 32680)
+            nSecPerClus = 2;    /* < 16M */
+        else if (uTotal <= 262144)
+            nSecPerClus = 4;    /* 16M~128M */
+        else if (uTotal <= 524288)
+            nSecPerClus = 8;    /* 128M~256M */
+        else
+            nSecPerClus = 16;   /* 256M~260M */
+        uRsvSecNum = 1;
+        uRootSecNum = 32;       /* 512 root entries */
+        uData1 = 256 * nSecPerClus + 2;
+    } else {
+        if (uTotal < 16777216)
+            nSecPerClus = 8; /* < 8G */
+        else if (uTotal < 33554432)
+            nSecPerClus = 16; /* 8G~16G */
+        else if (uTotal < 67108864)
+            nSecPerClus = 32; /* 16GB~32GB */
+        else
+            nSecPerClus = 64; /* >= 32GB */
+        uRsvSecNum = 34;
+        uRootSecNum = nSecPerClus;  /* root directory cluster */
+        uData1 = (256 * nSecPerClus + 2) / 2;
+    }
 
-    if(pucSecBuff==NULL) return NULL;
-    memset(pucSecBuff, 0x0, 512*WriteLen);
-    pucPtr=pucSecBuff;
+    /* FAT size, closed form */
+    uFatSize = (uTotal - uRsvSecNum - (bIsFat16 ? uRootSecNum : 0) + uData1 - 1) / uData1;
+    MSG_DEBUG("partition at %d: FAT%d, %d sectors per cluster, FAT size %d\n", uFirst, bIsFat16 ? 16 : 32, nSecPerClus, uFatSize);
     SendAck(20);
-    MSG_DEBUG("20\n");
-
-    if(nCount == 0) {
-        for (uLogSecNo = pmbr->mbrPartition[nCount].pteFirstSector, uData1 = 0; uData1 < uRsvSecNum; ) {
-            nWrtSecNum = MIN(WriteLen, (uRsvSecNum-uData1));
-            nStatus = fmiSDWrite(uLogSecNo, nWrtSecNum, pucSecBuff);
-            MSG_DEBUG("uRsvSecNum=%d  nWrtSecNum =%d  uLogSecNo=%d(0x%x)  uData1=%d\n", uRsvSecNum, nWrtSecNum, uLogSecNo, uLogSecNo, uData1);
-            if (nStatus < 0) {
-                fsFreeSector(pucSecBuff);
-                return nStatus;
-            }
-            uLogSecNo += nWrtSecNum;
-            uData1 += nWrtSecNum;
-            MSG_DEBUG("uLogSecNo=%d(0x%x)  uData1 =%d \n", uLogSecNo, uLogSecNo, uData1);
-        }
+
+    /*
+     * Clear reserved sectors, FAT1, FAT2 and the root directory. TRIM the whole
+     * partition on eMMC instead, free space is released too.
+     */
+    bIsTrimmed = (fmiSD_Trim(uFirst, uTotal) == Successful);
+    MSG_DEBUG("partition at %d %s\n", uFirst, bIsTrimmed ? "trimmed" : "not trimmed, clear by writing");
+    if (!bIsTrimmed) {
+        nStatus = fsWriteZero(uFirst, uRsvSecNum + uFatSize * 2 + uRootSecNum);
+        if (nStatus < 0)
+            return nStatus;
     }
-    SendAck(25);
-    MSG_DEBUG("25\n");
+    SendAck(40);
+
     /*
      * Create the BPB sector
      */
-    memcpy(pucSecBuff, bpb_sample, sizeof(bpb_sample));
-    pucPtr = pucSecBuff;
-
-    /* determine the cluster size */
-    if (pmbr->mbrPartition[nCount].ptePartitionSize < 16777216)
-        nSecPerClus = 8; /* < 8G */
-    else if (pmbr->mbrPartition[nCount].ptePartitionSize < 33554432)
-        nSecPerClus = 16; /* 8G~16G */
-    else if (pmbr->mbrPartition[nCount].ptePartitionSize < 67108864)
-        nSecPerClus = 32; /* 16GB~32GB */
-    else
-        nSecPerClus = 64; /* >= 32GB */
-
-    pucSecBuff[13] = nSecPerClus;
+    if (bIsFat16) {
+        memset(pucSecBuff, 0x0, 512);
+        memcpy(pucSecBuff, bpb_sample, 11);     /* jump and OEM name */
+        pucSecBuff[1] = 0x3C;
+        PUT16_L(pucPtr,11,512);
+        pucSecBuff[13] = nSecPerClus;
+        PUT16_L(pucPtr,14,uRsvSecNum);
+        pucSecBuff[16] = 2;                     /* number of FATs */
+        PUT16_L(pucPtr,17,uRootSecNum * 16);    /* root entries */
+        if (uTotal < 65536) {
+            PUT16_L(pucPtr,19,uTotal);
+        } else {
+            PUT32_L(pucPtr,32,uTotal);
+        }
+        pucSecBuff[21] = 0xF8;                  /* media */
+        PUT16_L(pucPtr,22,uFatSize);
+        pucSecBuff[36] = 0x80;                  /* drive number */
+        pucSecBuff[38] = 0x29;                  /* extended boot signature */
+        PUT32_L(pucPtr,39, get_timer_ticks());  /* volume serial number */
+        memcpy(pucSecBuff + 43, "NO NAME    FAT16   ", 19);
+        pucSecBuff[510] = 0x55;
+        pucSecBuff[511] = 0xAA;
+    } else {
+        memcpy(pucSecBuff, bpb_sample, sizeof(bpb_sample));
+        pucSecBuff[13] = nSecPerClus;
+        PUT16_L(pucPtr,14,uRsvSecNum);
+        PUT32_L(pucPtr,32,uTotal);
+        PUT32_L(pucPtr,36,uFatSize);
+        PUT32_L(pucPtr,44,uRootClus);           /* root directory cluster number */
+        PUT16_L(pucPtr,48,1);                   /* FSInfo sector */
+        PUT16_L(pucPtr,50,6);                   /* BPB backup sector */
+        PUT32_L(pucPtr,67, get_timer_ticks());  /* volume serial number */
+    }
 
-    //pmbr->mbrPartition[nCount].pteFirstSector
     /* sector per track */
-    PUT16_L(pucPtr,24,pmbr->mbrPartition[nCount].pteEndSector);
+    PUT16_L(pucPtr,24,pte->pteEndSector);
 
     /* number of heads */
-    PUT16_L(pucPtr,26,pmbr->mbrPartition[nCount].pteStartHead);
+    PUT16_L(pucPtr,26,pte->pteStartHead);
 
     /* number of hidden sectors preceding the partition */
-    PUT32_L(pucPtr,28,pmbr->mbrPartition[nCount].pteStartSector);
-
-    /* write FAT32 total sector number */
-    PUT32_L(pucPtr,32,pmbr->mbrPartition[nCount].ptePartitionSize);
-
-    /* calculate and write FAT size */
-    uData1 = pmbr->mbrPartition[nCount].ptePartitionSize - (uRsvSecNum + 1);
-    uData1 = ((uData1 + nSecPerClus - 1) / nSecPerClus) - 1;  // rough number of clusters
-    uFatSize = 1;
-
-    for (uData2 = 0; uData2 < uData1; uData2 += 128) {
-        uFatSize ++; // FAT1 and FAT2
-        if (((uFatSize * 2) % nSecPerClus) == 0)
-            uData1--;
-    }
-    //_debug_msg("uFatSize=%d\n", uFatSize);
-    PUT32_L(pucPtr,36,uFatSize);
-
-    /* Volume serial number */
-    PUT32_L(pucPtr,67, get_timer_ticks());
-
-    /* root directory cluster number */
-    PUT32_L(pucPtr,44,uRootClus);
-
-    /* pucFSInfo sector */
-    PUT16_L(pucPtr,48,1);
-
-    /* BPB bakcup sector */
-    PUT16_L(pucPtr,50,6);
+    PUT32_L(pucPtr,28,uFirst);
 
     /* write bpb sector */
-
-    nStatus = fmiSDWrite(pmbr->mbrPartition[nCount].pteFirstSector, 1, pucSecBuff);
-    if (nStatus < 0) {
-        fsFreeSector(pucSecBuff);
-        return nStatus;
-    }
-
-    /* write backup bpb sector */
-    nStatus = fmiSDWrite(pmbr->mbrPartition[nCount].pteFirstSector+6, 1, pucSecBuff);
-    if (nStatus < 0) {
-        fsFreeSector(pucSecBuff);
+    nStatus = fmiSDWrite(uFirst, 1, pucSecBuff);
+    if (nStatus < 0)
         return nStatus;
-    }
-    SendAck(30);
-    MSG_DEBUG("30\n");
-    /*
-     * Create pucFSInfo sector
-     */
-    memset(pucSecBuff, 0x0, 512);
-    pucSecBuff[510] = 0x55;
-    pucSecBuff[511] = 0xAA;
-
-    /* lead signature */
-    PUT32_L(pucPtr,0,0x41615252);
-
-    /* structure signature */
-    PUT32_L(pucPtr,484,0x61417272);
-
-    /* free cluster count */
-    PUT32_L(pucPtr,488,0xFFFFFFFF);
 
-    /* Next free cluster */
-    PUT32_L(pucPtr,492,2);
+    if (!bIsFat16) {
+        /* write backup bpb sector */
+        nStatus = fmiSDWrite(uFirst+6, 1, pucSecBuff);
+        if (nStatus < 0)
+            return nStatus;
 
-    /* write FS_Info sector */
-    nStatus = fmiSDWrite(pmbr->mbrPartition[nCount].pteFirstSector+1, 1, pucSecBuff);
-    if (nStatus < 0) {
-        fsFreeSector(pucSecBuff);
-        return nStatus;
+        /*
+         * Create pucFSInfo sector
+         */
+        memset(pucSecBuff, 0x0, 512);
+        pucSecBuff[510] = 0x55;
+        pucSecBuff[511] = 0xAA;
+        PUT32_L(pucPtr,0,0x41615252);           /* lead signature */
+        PUT32_L(pucPtr,484,0x61417272);         /* structure signature */
+        PUT32_L(pucPtr,488,0xFFFFFFFF);         /* free cluster count */
+        PUT32_L(pucPtr,492,2);                  /* Next free cluster */
+
+        /* write FS_Info sector and its backup */
+        nStatus = fmiSDWrite(uFirst+1, 1, pucSecBuff);
+        if (nStatus < 0)
+            return nStatus;
+        nStatus = fmiSDWrite(uFirst+7, 1, pucSecBuff);
+        if (nStatus < 0)
+            return nStatus;
+    } else if ((pmbr != NULL) && (pte->pteSystemID != 0x0E)) {
+        /* partition type FAT16 (LBA) */
+        pte->pteSystemID = 0x0E;
+        nStatus = fmiSDWrite(0, 1, (UINT8 *)pmbr);
+        if (nStatus < 0)
+            return nStatus;
     }
+    SendAck(60);
 
-    /* write backup FS_Info sector */
-    nStatus = fmiSDWrite(pmbr->mbrPartition[nCount].pteFirstSector+7, 1, pucSecBuff);
-    if (nStatus < 0) {
-        fsFreeSector(pucSecBuff);
-        return nStatus;
-    }
-    SendAck(40);
-    MSG_DEBUG("40\n");
     /*
-     * Clear FAT table. The start of FAT table is ptPartition->uStartSecN + uRsvSecNum
+     * First sector of FAT1 and FAT2: media and end-of-chain entries
      */
     memset(pucSecBuff, 0x0, 512);
-    uLogSecNo = pmbr->mbrPartition[nCount].pteFirstSector + uRsvSecNum;
-    memcpy(pucSecBuff, pucCode, sizeof(pucCode));
-    fmiSDWrite(uLogSecNo, 1, pucSecBuff);
-    uLogSecNo++;
-
-    memset(pucSecBuff, 0x0, 512*WriteLen);
-    for (uData1 = 0; uData1 < uFatSize*2; ) {
-				printf("[CWWeng] uData1[%d], uFatSize[%d]\n",uData1,uFatSize);
-        nWrtSecNum = MIN(WriteLen, (uFatSize*2 - uData1));
-        MSG_DEBUG("nWrtSecNum = %d\n", nWrtSecNum);
-        nStatus = fmiSDWrite(uLogSecNo, nWrtSecNum, pucSecBuff);
-        if (nStatus < 0) {
-            fsFreeSector(pucSecBuff);
+    if (bIsFat16)
+        memcpy(pucSecBuff, FAT16Rsv, sizeof(FAT16Rsv));
+    else
+        memcpy(pucSecBuff, FAT32Rsv, sizeof(FAT32Rsv));
+    for (uData1 = 0; uData1 < 2; uData1++) {
+        nStatus = fmiSDWrite(uFirst + uRsvSecNum + uFatSize * uData1, 1, pucSecBuff);
+        if (nStatus < 0)
             return nStatus;
-        }
-        uLogSecNo += nWrtSecNum;
-        uData1 += nWrtSecNum;
-        //if((uData1*40/(uFatSize*2))%5==0)
-        {
-            SendAck(40+(uData1*40/(uFatSize*2)));
-            MSG_DEBUG("%d\n",40+(uData1*40/(uFatSize*2)));
-        }
     }
-    SendAck(80);
-    MSG_DEBUG("80\n");
-    /*
-     * Clear Root directory cluster
-     */
-    memset(pucSecBuff, 0x0, 512);
-    uLogSecNo = pmbr->mbrPartition[nCount].pteFirstSector + uRsvSecNum + uFatSize * 2 + (uRootClus - 2) * nSecPerClus;
-    for (uData1 = 0; uData1 < nSecPerClus; uData1++, uLogSecNo++)
-        fmiSDWrite(uLogSecNo, 1, pucSecBuff);
-
-    memcpy(pucSecBuff, FAT32Rsv, 12);
-    fmiSDWrite(pmbr->mbrPartition[nCount].pteFirstSector + uRsvSecNum, 1, pucSecBuff);
 
     fsFreeSector(pucSecBuff);
     SendAck(90);
     MSG_DEBUG("90\n");
     return TRUE;
 }
+
+INT32 FormatFat32(PMBR pmbr,UINT32 nCount)
+{
+    return FormatFat(pmbr, &pmbr->mbrPartition[nCount]);
+}
+
+INT32 FormatFatRange(UINT32 uFirst, UINT32 uTotal)
+{
+    PTE pte;
+
+    memset(&pte, 0, sizeof(PTE));
+    pte.pteStartHead = 255;
+    pte.pteEndSector = 63;
+    pte.pteFirstSector = uFirst;
+    pte.ptePartitionSize = uTotal;
+    return FormatFat(NULL, &pte);
+}
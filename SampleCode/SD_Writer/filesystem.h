@@ -81,6 +81,8 @@ static UINT32 TotalSector=0;
 INT fmiSDWrite(UINT32 uStartSecN,UINT32 nCount,UINT8 *pucSecBuff);
 //PMBR create_mbr(UINT32 TotalSize,UINT32 HideSize);
 PMBR create_mbr(UINT32 TotalSize, FW_MMC_IMAGE_T *myPmmcImage);
+INT32 create_gpt(UINT32 TotalSize, FW_MMC_IMAGE_T *myPmmcImage, FW_MMC_PART_T *pPart, UINT32 nCount);
 INT32 FormatFat32(PMBR pmbr,UINT32 nCount);
+INT32 FormatFatRange(UINT32 uFirst, UINT32 uTotal);
 void MBR_DecodingCHS(UINT32 PartitionSize, UINT32 *CIdx, UINT32 *TIdx, UINT32 *SIdx);
 #endif /*FILESYSTEM_H_*/
@@ -101,6 +101,7 @@ typedef struct fmi_sd_info_t {
     UINT32  uCardType;      // sd2.0, sd1.1, or mmc
     UINT32  uRCA;           // relative card address
     BOOL    bIsCardInsert;
+    BOOL    bIsSelected;    // CMD7 selected, kept between transfers
 } FMI_SD_INFO_T;
 
 extern FMI_SD_INFO_T *_pSD0, *_pSD1;
@@ -124,10 +125,34 @@ typedef struct fmi_sm_info_t {
     BOOL    bIsMLCNand;
     BOOL    bIsInResetState;
     BOOL    bIsRA224;
+    BOOL    bIsCacheProgram;    // ONFI page cache program (0x15) supported
+    UINT32  uPlaneNum;          // ONFI multi-plane operations, 0/1 for single plane
+    UINT32  uTimingModes;       // ONFI SDR timing modes supported, bit n for mode n
+    BOOL    bIsSetFeature;      // ONFI get/set features supported
 } FMI_SM_INFO_T;
 
 extern FMI_SM_INFO_T *pSM;
 
+/* spare area content of programmed pages, see fmiSM_Write_Pages_Oob() */
+#define NAND_OOB_MARKER 0   // 0x0000FFFF used page marker
+#define NAND_OOB_FF     1   // free bytes 0xFF
+#define NAND_OOB_IMAGE  2   // page + spare source, free bytes from the source spare
+#define NAND_OOB_TAGS   3   // page + spare source, source spare behind the used page marker
+
+#define NAND_ECC_HIST   6   // corrected bits in the worst field of a page: 0, 1, 2-3, 4-7, 8-15, 16+
+
+/* burn statistics: pages programmed, and BCH status of the pages read back by fmiSM_Verify_Block() */
+typedef struct fmi_sm_ecc_stat_t {
+    UINT32  uPageProgram;
+    UINT32  uPageBlank;                 // pages of all 0xFF left erased
+    UINT32  uPageRead;
+    UINT32  uPageUncorrect;
+    UINT32  uPageMismatch;              // read without ECC error but differs from the source
+    UINT32  uPageHist[NAND_ECC_HIST];
+} FMI_SM_ECC_STAT_T;
+
+extern FMI_SM_ECC_STAT_T SMEccStat;
+
 /* F/W update information */
 typedef struct fw_update_info_t {
     UINT16  imageNo;
@@ -206,6 +231,21 @@ typedef struct fw_mmc_image_t {
     UINT32  PartitionS4Size; //Sector size unit 512Byte
 } FW_MMC_IMAGE_T;
 
+/* GPT partition, [Format] Part= line */
+#define MMC_MAX_PART    32
+
+#define MMC_PART_FAT    0   // Microsoft basic data, formatted FAT16/FAT32
+#define MMC_PART_LINUX  1   // Linux filesystem data, left empty
+#define MMC_PART_SWAP   2   // Linux swap, left empty
+
+typedef struct fw_mmc_part_t {
+    CHAR    Name[36];
+    UINT32  Size;           //unit of MB, 0: up to the end of the device
+    UINT32  Type;           //MMC_PART_xxx
+    UINT32  FirstSector;    //filled by create_gpt
+    UINT32  SectorCount;    //filled by create_gpt
+} FW_MMC_PART_T;
+
 
 typedef struct _info {
     UINT32  Nand_uPagePerBlock;
@@ -304,6 +344,37 @@ typedef struct _PACK_HEAD {
 #pragma no_anon_unions
 #endif
 
+/* busy wait operation type, selects deadline and statistics slot */
+#define WAIT_SPINAND_READ   0
+#define WAIT_SPINAND_PROG   1
+#define WAIT_SPINAND_ERASE  2
+#define WAIT_SPINAND_MISC   3
+#define WAIT_NOR_PROG       4
+#define WAIT_NOR_ERASE      5
+#define WAIT_NOR_MISC       6
+#define WAIT_NAND_READ      7
+#define WAIT_NAND_PROG      8
+#define WAIT_NAND_ERASE     9
+#define WAIT_NAND_RESET     10
+#define WAIT_NAND_CACHE     11
+#define WAIT_OP_NUM         12
+
+#define WAIT_HIST           8   /* busy time buckets: <16us, <64us, ... x4 ..., >=64ms */
+
+typedef struct wait_stat_t {
+    UINT32  Count;
+    UINT32  Timeout;
+    UINT32  MinUs;
+    UINT32  MaxUs;
+    UINT64  TotalUs;
+    UINT32  Hist[WAIT_HIST];
+} WAIT_STAT_T;
+
+extern WAIT_STAT_T WaitStat[WAIT_OP_NUM];
+
+INT  WaitReady(UINT32 op, INT (*isReady)(VOID));
+VOID WaitReadyReport(VOID);
+
 // function declaration
 #ifdef DMAC_SCATTER_GETTER
 INT  dmacSetDescriptor(UINT32 uaddr, UINT32 ucount);
@@ -321,6 +392,7 @@ INT  fmiSD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 u
 
 // SM functions
 INT fmiSMCheckRB(void);
+INT fmiSMWaitRB(UINT32 op);
 INT fmiSM_Reset(void);
 VOID fmiSM_Initial(FMI_SM_INFO_T *pSM);
 INT fmiSM_ReadID(FMI_SM_INFO_T *pSM);
@@ -329,8 +401,14 @@ INT fmiSM_Read_RA(UINT32 uPage, UINT32 ucColAddr);
 INT fmiCheckInvalidBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo);
 INT fmiSM_BlockErase(FMI_SM_INFO_T *pSM, UINT32 uBlock);
 INT fmiSM_BlockEraseBad(FMI_SM_INFO_T *pSM, UINT32 uBlock);
+INT fmiSM_EraseAhead(FMI_SM_INFO_T *pSM, UINT32 uBlock);
+INT fmiSM_EraseSync(void);
+INT fmiSM_BlockPrepare(FMI_SM_INFO_T *pSM, UINT32 uBlock);
+BOOL fmiSM_IsClean(UINT32 uBlock);
+BOOL fmiSM_BlockUsable(FMI_SM_INFO_T *pSM, UINT32 uBlock);
 INT fmiMarkBadBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo);
 INT CheckBadBlockMark(FMI_SM_INFO_T *pSM, UINT32 block);
+INT fmiSM_ScanBadBlock(FMI_SM_INFO_T *pSM);
 INT fmiSM_ChipErase(UINT32 uChipSel);
 INT fmiSM_ChipEraseBad(UINT32 uChipSel);
 INT fmiSM_Erase(UINT32 uChipSel, UINT32 start, UINT32 len);
@@ -339,7 +417,19 @@ INT fmiSM_EraseBad(UINT32 uChipSel, UINT32 start, UINT32 len);
 INT fmiHWInit(void);
 INT fmiNandInit(void);
 INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr);
+INT fmiSM_Write_Pages(UINT32 uPage, UINT32 uCount, UINT32 uSAddr);
+INT fmiSM_Write_Pages_Oob(UINT32 uPage, UINT32 uCount, UINT32 uSAddr, UINT32 uOob);
+INT fmiSM_Write_Pages_Skip(UINT32 uPage, UINT32 uCount, UINT32 uSAddr, UINT32 uOob);
+BOOL fmiSM_IsBlank(UINT32 uAddr, UINT32 uLen);
+UINT32 fmiSM_OobFree(VOID);
+UINT32 fmiSM_PageStride(UINT32 uOob);
+BOOL fmiSM_PlanePair(FMI_SM_INFO_T *pSM, UINT32 uBlock);
+INT fmiSM_BlockPrepare_Plane2(FMI_SM_INFO_T *pSM, UINT32 uBlock);
+INT fmiSM_Write_Pages_Plane2(UINT32 uBlock, UINT32 uCount, UINT32 uSAddr, UINT32 uSAddr2);
 INT fmiSM_Read_large_page(FMI_SM_INFO_T *pSM, UINT32 uPage, UINT32 uDAddr);
+INT fmiSM_Verify_Block(FMI_SM_INFO_T *pSM, UINT32 uBlock, UINT32 uSAddr, UINT32 uCount, UINT32 uOob, UINT32 *puFlips);
+UINT32 fmiSM_ECC_Strength(VOID);
+VOID fmiSM_ECC_Report(VOID);
 
 INT fmiSM_Write_large_page_oob(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr,UINT32 oobsize);
 INT fmiSM_Write_large_page_oob2(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr);
@@ -155,6 +155,115 @@ void DelayMicrosecond(unsigned int count)
     }
 }
 
+/* Busy wait deadline of each operation, micro-second, about 2~3 times of the datasheet max */
+static const UINT32 WaitDeadline[WAIT_OP_NUM] = {
+    1000,       /* SPI NAND tRD      */
+    3000,       /* SPI NAND tPROG    */
+    20000,      /* SPI NAND tBERS    */
+    5000,       /* SPI NAND reset / feature */
+    10000,      /* SPI NOR tPP       */
+    4000000,    /* SPI NOR 64KB tBE  */
+    100000,     /* SPI NOR tW        */
+    3000,       /* NAND tR           */
+    3000,       /* NAND tPROG        */
+    20000,      /* NAND tBERS        */
+    3000,       /* NAND tRST         */
+    3000,       /* NAND tCBSY/tIPBSY */
+};
+static const char *WaitName[WAIT_OP_NUM] = {
+    "SPI NAND read", "SPI NAND prog", "SPI NAND erase", "SPI NAND misc",
+    "SPI NOR prog", "SPI NOR erase", "SPI NOR misc",
+    "NAND read", "NAND prog", "NAND erase", "NAND reset", "NAND cache/plane",
+};
+WAIT_STAT_T WaitStat[WAIT_OP_NUM];
+
+/* ETimer2 runs free at 1MHz as the busy time base, ETimer0 stays for SetTimer() */
+static UINT32 WaitTick(void)
+{
+    if (!(inpw(REG_ETMR2_CTL) & 0x1)) {
+        outpw(REG_CLK_PCLKEN0, inpw(REG_CLK_PCLKEN0) | 0x400);  /* enable timer2 engine clock */
+        outpw(REG_ETMR2_CMPR, 0xFFFFFF);
+        outpw(REG_ETMR2_PRECNT, 0xB);
+        outpw(REG_ETMR2_CTL, 0x31);     /* continuous mode, prescale = 12 */
+    }
+    return inpw(REG_ETMR2_DR) & 0xFFFFFF;
+}
+
+/*
+    Wait until isReady() returns non-zero or the deadline of op passed.
+    The first status poll is held off to 3/4 of the shortest busy time seen so far,
+    then the poll interval doubles up to 1/16 of the average busy time.
+    return Successful or Fail(timeout)
+*/
+INT WaitReady(UINT32 op, INT (*isReady)(VOID))
+{
+    WAIT_STAT_T *ps = &WaitStat[op];
+    UINT32 last, now, elapsed, next, poll, cap, t, i;
+
+    if (ps->Count) {
+        next = ps->MinUs * 3 / 4;
+        poll = ps->MinUs / 16;
+        cap  = (UINT32)(ps->TotalUs / ps->Count) / 16;
+    } else {
+        next = 0;
+        poll = 2;
+        cap  = WaitDeadline[op] / 64;
+    }
+    if (poll < 2)   poll = 2;
+    if (cap < poll) cap = poll;
+
+    elapsed = 0;
+    last = WaitTick();
+    while(1) {
+        now = WaitTick();
+        elapsed += (now - last) & 0xFFFFFF;
+        last = now;
+
+        if (elapsed >= next) {
+            if (isReady()) {
+                if ((ps->Count == 0) || (elapsed < ps->MinUs))
+                    ps->MinUs = elapsed;
+                if (elapsed > ps->MaxUs)
+                    ps->MaxUs = elapsed;
+                ps->Count++;
+                ps->TotalUs += elapsed;
+                for (i=0, t=elapsed>>4; (t != 0) && (i < WAIT_HIST-1); i++)
+                    t >>= 2;
+                ps->Hist[i]++;
+                return Successful;
+            }
+            next = elapsed + poll;
+            poll <<= 1;
+            if (poll > cap)
+                poll = cap;
+        }
+
+        if (elapsed >= WaitDeadline[op]) {
+            ps->Timeout++;
+            printf("Error %s busy timeout %d us\n", WaitName[op], elapsed);
+            return Fail;
+        }
+    }
+}
+
+void WaitReadyReport(void)
+{
+    int i, j;
+    WAIT_STAT_T *ps;
+
+    for (i=0; i<WAIT_OP_NUM; i++) {
+        ps = &WaitStat[i];
+        if ((ps->Count == 0) && (ps->Timeout == 0))
+            continue;
+        printf("%-14s: %d waits, min/avg/max %d/%d/%d us, timeout %d\n", WaitName[i], ps->Count,
+               ps->MinUs, ps->Count ? (UINT32)(ps->TotalUs / ps->Count) : 0, ps->MaxUs, ps->Timeout);
+        printf("                ");
+        for (j=0; j<WAIT_HIST; j++)
+            printf(" %d", ps->Hist[j]);
+        printf("  (<16us, x4 per bucket)\n");
+    }
+}
+
 BYTE SDH_Drv; // select SD0
 
 void  dump_buff_hex(uint8_t *pucBuff, int nBytes)
@@ -828,6 +937,620 @@ static void Form_BootCode_Header(unsigned int *header_size)
     f_close(&file1);
 }
 
+/* SPI NAND block blkindx can not be used: with [SPINAND] BBM_LUT=1 link it to a
+   spare block so the image layout stays contiguous. Return 1 to retry blkindx. */
+static int spiNAND_Remap_Block(uint32_t blkindx)
+{
+    if (Ini_Writer.SpiNand.BBM_LUT != 1)
+        return 0;
+    if (spiNAND_LUT_Remap(blkindx) != 0) {
+        printf("BBM LUT remap block %d fail, skip it\n", blkindx);
+        return 0;
+    }
+    printf("BBM LUT remap block %d done\n", blkindx);
+    return 1;
+}
+
+/* [SPINAND] Verify=1: read back a programmed block and collect its ECC status.
+   Return 0: good, 1: rewrite the block once (scrub), 2: treat the block as bad */
+static int spiNAND_Verify(uint32_t blkindx, uint8_t *data, uint32_t page_count, int scrubbed)
+{
+    uint32_t corrected;
+
+    if (Ini_Writer.SpiNand.Verify != 1)
+        return 0;
+
+    WDT_RSTCNT;
+    if (spiNAND_Verify_Block(blkindx, data, Block_Buff, page_count, &corrected) != 0) {
+        printf("Verify block %d fail!\n", blkindx);
+        return 2;
+    }
+    if ((Ini_Writer.SpiNand.ScrubThreshold != 0) && (corrected >= Ini_Writer.SpiNand.ScrubThreshold)) {
+        printf("Block %d: %d pages with corrected bit flips%s\n", blkindx, corrected, scrubbed ? ", bad block" : ", scrub");
+        return scrubbed ? 2 : 1;
+    }
+    return 0;
+}
+
+/* check the erase issued on SPI NAND block blockNum (its die is selected) */
+static void spiNAND_Erase_Done(uint32_t blockNum)
+{
+    spiNAND_Wait(WAIT_SPINAND_ERASE);
+    if (spiNAND_Check_Program_Erase_Fail_Flag() != 0) {
+        printf("Error erase status! bad_block:%d\n", blockNum);
+        spiNANDMarkBadBlock(blockNum*pSN->SPINand_PagePerBlock);
+    } else {
+        spiNAND_Clean_Set(blockNum, 1);
+        printf("BlockErase %d Done\n", blockNum);
+    }
+}
+
+/* Erase-ahead of the image loops: the next block is erased while the loop
+   reads its data from SD. Only one erase is in flight, any other SPI NAND
+   access has to call spiNAND_Erase_Sync() first. */
+static int spiNAND_Erase_Pending = -1;
+
+static void spiNAND_Erase_Sync(void)
+{
+    uint32_t blockNum;
+
+    if (spiNAND_Erase_Pending < 0)
+        return;
+    blockNum = spiNAND_Erase_Pending;
+    spiNAND_Erase_Pending = -1;
+    spiNAND_Die_Page(blockNum*pSN->SPINand_PagePerBlock);
+    spiNAND_Erase_Done(blockNum);
+}
+
+static void spiNAND_Erase_Ahead(uint32_t blockNum)
+{
+    uint32_t PA_Num, dpage;
+
+    spiNAND_Erase_Sync();
+    if ((blockNum >= pSN->SPINand_BlockPerFlash) || spiNAND_Is_Clean(blockNum))
+        return;
+    PA_Num = blockNum*pSN->SPINand_PagePerBlock;
+    if (spiNAND_bad_block_check(PA_Num) == 1)
+        return;
+    dpage = spiNAND_Die_Page(PA_Num);
+    spiNAND_BlockErase_NoWait((dpage>>8)&0xFF, dpage&0xFF);
+    spiNAND_Erase_Pending = blockNum;
+}
+
+/* erase blockNum for programming unless it is still clean, return the erase fail flag */
+static uint8_t spiNAND_Erase_Prepare(uint32_t blockNum)
+{
+    uint32_t dpage;
+
+    spiNAND_Erase_Sync();
+    if (spiNAND_Is_Clean(blockNum))
+        return 0;
+    dpage = spiNAND_Die_Page(blockNum*pSN->SPINand_PagePerBlock);
+    spiNAND_BlockErase(((dpage>>8)&0xFF), (dpage&0xFF)); // block erase
+    return spiNAND_Check_Program_Erase_Fail_Flag();
+}
+
+/* Erase SPI NAND blocks [start, start+count). On stacked (W25M) parts the dies
+   are visited in turn, so one die erases while the next die is checked/erased. */
+static void spiNAND_Erase_Blocks(uint32_t start, uint32_t count)
+{
+    int pending[SPINAND_MAX_DIE];   // block erasing on each die, -1 for idle
+    uint32_t first[SPINAND_MAX_DIE], last[SPINAND_MAX_DIE];
+    uint32_t i, die, rows, die_blocks, blockNum, PA_Num, dpage;
+
+    rows = 0;
+    die_blocks = pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum;
+    for (die = 0; die < pSN->SPINand_DieNum; die++) {
+        pending[die] = -1;
+        first[die] = MAX(start, die*die_blocks);
+        last[die] = MIN(start+count, (die+1)*die_blocks);
+        if ((last[die] > first[die]) && (last[die]-first[die] > rows))
+            rows = last[die]-first[die];
+    }
+
+    for (i = 0; i < rows; i++) {
+        for (die = 0; die < pSN->SPINand_DieNum; die++) {
+            blockNum = first[die] + i;
+            if (blockNum >= last[die])
+                continue;
+            WDT_RSTCNT;
+            PA_Num = blockNum*pSN->SPINand_PagePerBlock;
+            dpage = spiNAND_Die_Page(PA_Num);
+            if (pending[die] >= 0) {
+                spiNAND_Erase_Done(pending[die]);
+                pending[die] = -1;
+            }
+            if (spiNAND_bad_block_check(PA_Num) == 1) {
+                printf("bad_block:%d\n", blockNum);
+                continue;
+            }
+            spiNAND_BlockErase_NoWait((dpage>>8)&0xFF, dpage&0xFF);
+            pending[die] = blockNum;
+        }
+    }
+
+    for (die = 0; die < pSN->SPINand_DieNum; die++) {
+        if (pending[die] < 0)
+            continue;
+        spiNAND_Die_Page(pending[die]*pSN->SPINand_PagePerBlock);
+        spiNAND_Erase_Done(pending[die]);
+    }
+}
+
+/* [NAND] Verify=1: read back a programmed block through the BCH engine.
+   Return 0: good, 1: the block is bad or weak, move its data to the next block */
+static int fmiSM_Verify(int blkindx, unsigned int addr, int page_count, unsigned int oob)
+{
+    UINT32 flips, threshold;
+
+    if (Ini_Writer.Nand.Verify != 1)
+        return 0;
+
+    WDT_RSTCNT;
+    if (fmiSM_Verify_Block(pSM, blkindx, addr, page_count, oob, &flips) != 0) {
+        printf("Verify block %d fail!\n", blkindx);
+        return 1;
+    }
+    threshold = Ini_Writer.Nand.BitflipThreshold;
+    if (threshold == 0)
+        threshold = fmiSM_ECC_Strength()*3/4;
+    if (flips >= threshold) {
+        printf("Block %d: %d bits corrected in one field (T%d), relocate\n", blkindx, flips, fmiSM_ECC_Strength());
+        return 1;
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * User image partitions on NAND / SPI NAND. An image owns the blocks from its
+ * address up to the next image or environment address (or the end of the
+ * flash), PartSize in the INI sets the length instead. BlockMap lists the
+ * usable blocks of the partition in order, the burn loop takes them one by
+ * one and a block that fails takes the next one; the image never grows past
+ * its partition.
+ *---------------------------------------------------------------------------*/
+#define MAX_MAP_BLOCK   16384
+
+static unsigned short BlockMap[MAX_MAP_BLOCK];
+
+static int fmiSM_Map_Usable(unsigned int blk)
+{
+    return fmiSM_BlockUsable(pSM, blk);
+}
+
+/* skip the blocks the BBM LUT reports (linked spares, blocks marked bad during
+   the burn) and the spare pool kept for spiNAND_LUT_Remap() */
+static int spiNAND_Map_Usable(unsigned int blk)
+{
+    if (spiNAND_BBT_IsBad(blk) || spiNAND_LUT_Is_Spare(blk))
+        return 0;
+    spiNAND_Erase_Sync();
+    return spiNAND_bad_block_check(blk * pSN->SPINand_PagePerBlock) != 1;
+}
+
+/* stop the burn if image ImgNo, blk_num blocks of blk_size, reaches into the
+   BBM LUT spare pool at the end of the device. An image may cross from one
+   die into the next, BlockMap skips the spare blocks at the end of the first. */
+static void spiNAND_Spare_Check(int ImgNo, unsigned int blk_size, unsigned int blk_num)
+{
+    unsigned int start, blk;
+
+    start = Ini_Writer.UserImage[ImgNo].address / blk_size;
+    for (blk = start; blk < start + blk_num; blk++) {
+        if (spiNAND_LUT_Is_Spare(blk) && (spiNAND_Block_To_Die(blk) == pSN->SPINand_DieNum - 1)) {
+            printf("Image [%s] blocks [%d - %d] reach the BBM LUT spare pool at block %d!\n",
+                   Ini_Writer.UserImage[ImgNo].FileName, start, start+blk_num-1, blk);
+            while(1) {
+                WDT_RSTCNT;
+            }
+        }
+    }
+}
+
+/* Build BlockMap for user image ImgNo, which needs need blocks of blk_size.
+   Stop the burn if the partition does not have that many usable blocks.
+   Return the number of blocks in BlockMap. */
+static int Image_Map(int ImgNo, int img_cnt, unsigned int blk_size, unsigned int blk_num,
+                     unsigned int need, int (*usable)(unsigned int))
+{
+    unsigned int start, end, blk;
+    int i, n;
+
+    start = Ini_Writer.UserImage[ImgNo].address / blk_size;
+    end = blk_num;
+    if (Ini_Writer.UserImage[ImgNo].PartSize != 0)
+        end = start + Ini_Writer.UserImage[ImgNo].PartSize / blk_size;
+    else {
+        for (i = 0; i < img_cnt; i++) {
+            blk = Ini_Writer.UserImage[i].address / blk_size;
+            if ((blk > start) && (blk < end))
+                end = blk;
+        }
+        blk = Ini_Writer.Env.address / blk_size;
+        if ((Ini_Writer.Env.user_choice == 1) && (blk > start) && (blk < end))
+            end = blk;
+    }
+    if (end > blk_num)
+        end = blk_num;
+    if (end > start + MAX_MAP_BLOCK)
+        end = start + MAX_MAP_BLOCK;
+
+    n = 0;
+    for (blk = start; blk < end; blk++) {
+        if (usable(blk))
+            BlockMap[n++] = blk;
+    }
+    if (n < need) {
+        printf("Image [%s] needs %d blocks, partition [%d - %d] has %d good blocks!\n",
+               Ini_Writer.UserImage[ImgNo].FileName, need, start, end-1, n);
+        while(1) {
+            WDT_RSTCNT;
+        }
+    }
+    return n;
+}
+
+/* NAND spare area layout of user image ImgNo */
+static unsigned int fmiSM_Image_Oob(int ImgNo)
+{
+    switch (Ini_Writer.UserImage[ImgNo].ImageType) {
+    case IMAGE_RAW:
+        return NAND_OOB_IMAGE;
+    case IMAGE_UBI:
+        return NAND_OOB_FF;
+    case IMAGE_YAFFS2:
+        return NAND_OOB_TAGS;
+    default:
+        return NAND_OOB_MARKER;
+    }
+}
+
+/* blocks taken by user image ImgNo, at least one */
+static unsigned int Image_Blocks(int ImgNo, unsigned int raw_size)
+{
+    unsigned int blocks;
+
+    blocks = (Ini_Writer.UserImage[ImgNo].DataSize + raw_size - 1) / raw_size;
+    return (blocks > 0) ? blocks : 1;
+}
+
+/* first logical block of the image whose BlockMap entry is not on the die of
+   block 0, nblk if the image stays on one die or Buff can not hold two blocks */
+static unsigned int spiNAND_Image_Split(unsigned int nblk)
+{
+    unsigned int lblk;
+
+    if ((pSN->SPINand_DieNum < 2) || (2*(pSN->SPINand_PagePerBlock)*(pSN->SPINand_PageSize) > BUFF_SIZE))
+        return nblk;
+    for (lblk = 1; lblk < nblk; lblk++) {
+        if (spiNAND_Block_To_Die(BlockMap[lblk]) != spiNAND_Block_To_Die(BlockMap[0]))
+            return lblk;
+    }
+    return nblk;
+}
+
+/*-----------------------------------------------------------------------------
+ * Burn SPI NAND user image ImgNo (opened as file2), logical block lblk goes to
+ * BlockMap[lblk]. On stacked (W25M) parts the blocks mapped to the second die
+ * form a second stream, every spiNAND_Program_Interleave() call takes the next
+ * block of each stream so both dies program at the same time. A block that
+ * can not be remapped is marked bad and BlockMap is built again: the blocks
+ * behind it move to the next good block and are written again.
+ *---------------------------------------------------------------------------*/
+static void spiNAND_Write_Image(int ImgNo, int img_cnt)
+{
+    SPINAND_PROG_JOB_T job[SPINAND_MAX_DIE];
+    unsigned int lblk[SPINAND_MAX_DIE], lend[SPINAND_MAX_DIE], stream[SPINAND_MAX_DIE];
+    unsigned int blk_size, nblk, split, blkindx, redo, n, i, s;
+    unsigned int scrub_blk = 0xFFFFFFFF;
+    unsigned char *addr;
+    UINT s2;
+    int nmap, status;
+
+    blk_size = (pSN->SPINand_PagePerBlock)*(pSN->SPINand_PageSize);
+    nblk = Image_Blocks(ImgNo, blk_size);
+    nmap = Image_Map(ImgNo, img_cnt, blk_size, pSN->SPINand_BlockPerFlash, nblk, spiNAND_Map_Usable);
+    printf("Img[%d] size = %d, blocks = %d, good blocks in partition = %d\n",ImgNo,Ini_Writer.UserImage[ImgNo].DataSize,nblk,nmap);
+
+    split = spiNAND_Image_Split(nblk);
+    lblk[0] = 0;
+    lend[0] = split;
+    lblk[1] = split;
+    lend[1] = nblk;
+
+    while ((lblk[0] < lend[0]) || (lblk[1] < lend[1])) {
+        WDT_RSTCNT;
+        redo = nblk;
+
+        /* load the next block of each stream from SD while the erase-ahead runs */
+        for (s = 0; s < SPINAND_MAX_DIE; s++) {
+            if (lblk[s] >= lend[s])
+                continue;
+            addr = (unsigned char*)Buff + s*blk_size;
+            memset((void*)addr, 0xFF, blk_size);
+            if ((f_lseek(&file2, lblk[s]*blk_size) != FR_OK) ||
+                (f_read(&file2, addr, blk_size, &s2) != FR_OK)) {
+                printf("read [%s] block %d fail!\n", Ini_Writer.UserImage[ImgNo].FileName, lblk[s]);
+                while(1) {   /* error or eof */
+                    WDT_RSTCNT;
+                }
+            }
+        }
+
+        /* then erase the blocks */
+        n = 0;
+        for (s = 0; s < SPINAND_MAX_DIE; s++) {
+            if (lblk[s] >= lend[s])
+                continue;
+            blkindx = BlockMap[lblk[s]];
+            printf("blkindx = %d   page = %d   page_count=%d\n", blkindx, blkindx*pSN->SPINand_PagePerBlock, pSN->SPINand_PagePerBlock);
+            spiNAND_Erase_Sync();
+            if (spiNAND_bad_block_check(blkindx*pSN->SPINand_PagePerBlock) == 1) {
+                printf("bad block = %d\n", blkindx);
+                if (!spiNAND_Remap_Block(blkindx))
+                    redo = lblk[s];
+                n = 0;
+                break;
+            }
+            if (spiNAND_Erase_Prepare(blkindx) != 0) {
+                printf("Error erase status! spiNANDMarkBadBlock blockNum = %d\n", blkindx);
+                spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                if (!spiNAND_Remap_Block(blkindx))
+                    redo = lblk[s];
+                n = 0;
+                break;
+            }
+
+            job[n].Page = blkindx*pSN->SPINand_PagePerBlock;
+            job[n].Buff = (unsigned char*)Buff + s*blk_size;
+            job[n].PageCount = pSN->SPINand_PagePerBlock;
+            job[n].SkipBlank = 1;
+            stream[n] = s;
+            n++;
+        }
+
+        if (n != 0) {
+            WDT_RSTCNT;
+            ETimer1_cnt = 0;
+            ETIMER_Start(1);
+            spiNAND_Program_Interleave(job, n);
+            ETIMER_Stop(1);
+            WDT_RSTCNT;
+
+            for (i = 0; i < n; i++) {
+                s = stream[i];
+                blkindx = BlockMap[lblk[s]];
+                status = job[i].PFail ? 2 : spiNAND_Verify(blkindx, job[i].Buff, job[i].PageCount, blkindx == scrub_blk);
+                if (status == 1) {
+                    scrub_blk = blkindx;    // program it once more
+                    continue;
+                }
+                if (status != 0) {
+                    spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                    printf("Error write status! Bad block[%d]!\n",blkindx);
+                    if (!spiNAND_Remap_Block(blkindx))
+                        redo = MIN(redo, lblk[s]);
+                    continue;
+                }
+                lblk[s]++;
+            }
+        }
+
+        if (redo < nblk) {
+            /* the mapping of every block from redo on changes */
+            Image_Map(ImgNo, img_cnt, blk_size, pSN->SPINand_BlockPerFlash, nblk, spiNAND_Map_Usable);
+            split = spiNAND_Image_Split(nblk);
+            lblk[0] = MIN(lblk[0], redo);
+            lend[0] = split;
+            lblk[1] = MAX(split, MIN(lblk[1], redo));
+            lend[1] = nblk;
+            continue;
+        }
+
+        if (lblk[0] < lend[0])
+            spiNAND_Erase_Ahead(BlockMap[lblk[0]]);
+        else if (lblk[1] < lend[1])
+            spiNAND_Erase_Ahead(BlockMap[lblk[1]]);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * eMMC image writes: each transfer takes a whole staging buffer, the first one
+ * is cut so the following ones start on an eMMC write unit (erase group or
+ * super page). head bytes (boot header) are already in Buff, then len bytes of
+ * file2 are written from byte offset on.
+ * Buff and Block_Buff form a ring: while the FMI DMA writes one buffer to the
+ * eMMC, the next data is read from the SD card on SDH into the other one. The
+ * read is split into pieces and the eMMC write is polled in between, so it
+ * moves on to its next DMA segment without waiting for the whole read.
+ *---------------------------------------------------------------------------*/
+static unsigned int eMMC_Unit = SD_SECTOR;
+
+#define EMMC_READ_PIECE     (32*1024)
+
+static void eMMC_Write_Wait(void)
+{
+    int status;
+
+    while ((status = fmiSD_WritePoll()) == SD_WRITE_BUSY);
+    if (status != Successful)
+        printf("eMMC write error 0x%x\n", status);
+}
+
+static void eMMC_Read_Piece(BYTE *buf, unsigned int size)
+{
+    FRESULT res;
+    unsigned int piece;
+    int status;
+
+    while (size > 0) {
+        piece = MIN(EMMC_READ_PIECE, size);
+        res = f_read(&file2, buf, piece, &s2);
+        if (res || s2 != piece) {
+            printf("res = %d,read size = %d\n",res,s2);
+            while(1) {   /* error or eof */
+                WDT_RSTCNT;
+            }
+        }
+        status = fmiSD_WritePoll();
+        if ((status != Successful) && (status != SD_WRITE_BUSY))
+            printf("eMMC write error 0x%x\n", status);
+        buf += piece;
+        size -= piece;
+    }
+}
+
+static void eMMC_Write_File(unsigned int offset, unsigned int len, unsigned int head)
+{
+    BYTE *ring[2];
+    unsigned int size, sectors, cur = 0;
+    int status;
+
+    ring[0] = Buff;
+    ring[1] = Block_Buff;
+    ETimer1_cnt = 0;
+    ETIMER_Start(1);
+    while (len > 0) {
+        WDT_RSTCNT;
+        size = MIN(BUFF_SIZE - (offset % eMMC_Unit) - head, len);
+        eMMC_Read_Piece(ring[cur] + head, size);
+        len -= size;
+        size += head;
+        head = 0;
+
+        // data that is less than a sector takes one more sector
+        sectors = (size + SD_SECTOR - 1) / SD_SECTOR;
+        memset(ring[cur] + size, 0, sectors * SD_SECTOR - size);
+        eMMC_Write_Wait();
+        status = fmiSD_WriteStart(offset/SD_SECTOR, sectors, (UINT32)ring[cur]);
+        if (status != Successful)
+            printf("eMMC write error 0x%x\n", status);
+        offset += size;
+        cur ^= 1;
+    }
+    eMMC_Write_Wait();
+    ETIMER_Stop(1);
+}
+
+/*-----------------------------------------------------------------------------
+ * Write-skipping eMMC image write: every chunk of the target is read back into
+ * Block_Buff and only written when it differs from the image. With a manifest
+ * <image>.crc next to the image (CRC32 of every 512 KB chunk of the image, one
+ * little-endian word per chunk) a matching chunk is not read from the SD card
+ * at all, without one the chunk is read and compared byte by byte.
+ *---------------------------------------------------------------------------*/
+#define SKIP_CHUNK      (512*1024)
+
+static void eMMC_Write_Skip(char *name, unsigned int offset, unsigned int len)
+{
+    static char crcname[sizeof(Ini_Writer.UserImage[0].FileName) + 4];
+    FRESULT res;
+    unsigned int size, sectors, crc, pos = 0, same, skipped = 0, total = 0;
+    BOOL bManifest, bRead;
+    UINT rd;
+    int status;
+
+    sprintf(crcname, "%s.crc", name);
+    bManifest = (f_open(&file1, crcname, FA_OPEN_EXISTING | FA_READ) == FR_OK) ? TRUE : FALSE;
+    if (bManifest)
+        printf("manifest [%s]\n", crcname);
+
+    while (len > 0) {
+        WDT_RSTCNT;
+        size = MIN(SKIP_CHUNK, len);
+        sectors = (size + SD_SECTOR - 1) / SD_SECTOR;
+        /* a chunk that can not be read back is written */
+        bRead = (fmiSD_Read(offset/SD_SECTOR, sectors, (UINT32)Block_Buff) == Successful) ? TRUE : FALSE;
+        if (!bRead)
+            printf("read back sector %d fail, write the chunk\n", offset/SD_SECTOR);
+
+        same = 0;
+        if (bManifest) {
+            res = f_read(&file1, &crc, 4, &rd);
+            if (res || rd != 4) {
+                printf("manifest [%s] too short, compare the data\n", crcname);
+                f_close(&file1);
+                bManifest = FALSE;
+            } else if (bRead && (crc == CalculateCRC32(Block_Buff, size))) {
+                same = 1;
+                f_lseek(&file2, pos + size);
+            }
+        }
+        if (!same) {
+            res = f_read(&file2, Buff, size, &s2);
+            if (res || s2 != size) {
+                printf("res = %d,read size = %d\n",res,s2);
+                while(1) {   /* error or eof */
+                    WDT_RSTCNT;
+                }
+            }
+            if (!bManifest && bRead && (memcmp(Buff, Block_Buff, size) == 0))
+                same = 1;
+        }
+        if (same) {
+            skipped++;
+        } else {
+            memset(Buff + size, 0, sectors * SD_SECTOR - size);
+            ETimer1_cnt = 0;
+            ETIMER_Start(1);
+            status = fmiSD_Write(offset/SD_SECTOR, sectors, (UINT32)Buff);
+            ETIMER_Stop(1);
+            if (status != Successful)
+                printf("eMMC write error 0x%x\n", status);
+        }
+        pos += size;
+        offset += size;
+        len -= size;
+        total++;
+    }
+    if (bManifest)
+        f_close(&file1);
+    printf("%d of %d chunks unchanged, not written\n", skipped, total);
+}
+
+/*-----------------------------------------------------------------------------
+ * Loader into the eMMC boot partitions: header and loader are assembled once
+ * in Buff and the same buffer is written to BOOT0 and BOOT1 at offset. The
+ * user area is used as before when the device has no boot partitions.
+ *---------------------------------------------------------------------------*/
+static void eMMC_Write_Boot(unsigned int offset, unsigned int len, unsigned int head)
+{
+    FRESULT res;
+    unsigned int size, sectors;
+    int status;
+
+    if (head + len > BUFF_SIZE) {
+        printf("loader %d bytes too large for the boot partition buffer\n", len);
+        while(1) {
+            WDT_RSTCNT;
+        }
+    }
+    WDT_RSTCNT;
+    res = f_read(&file2, Buff + head, len, &s2);
+    if (res || s2 != len) {
+        printf("res = %d,read size = %d\n",res,s2);
+        while(1) {   /* error or eof */
+            WDT_RSTCNT;
+        }
+    }
+    size = head + len;
+    sectors = (size + SD_SECTOR - 1) / SD_SECTOR;
+    memset(Buff + size, 0, sectors * SD_SECTOR - size);
+    ETimer1_cnt = 0;
+    ETIMER_Start(1);
+    status = fmiSD_WriteBoot(offset/SD_SECTOR, sectors, (UINT32)Buff);
+    if (status == Successful) {
+        printf("loader written to BOOT0 and BOOT1\n");
+    } else if (status == SD_NO_BOOT_PART) {
+        printf("no eMMC boot partition, loader written to the user area\n");
+        fmiSD_Write(offset/SD_SECTOR, sectors, (UINT32)Buff);
+    } else {
+        printf("eMMC boot partition write error 0x%x, %d sectors at %d (boot partition %d KB)\n",
+               status, sectors, offset/SD_SECTOR, _sd_ucExtCSD[226] * 128);
+    }
+    ETIMER_Stop(1);
+}
+
 int32_t main(void)
 {
     char        *ptr, *ptr2;
@@ -1235,53 +1958,45 @@ int32_t main(void)
         /* Initial SPI NAND */
         spiNANDInit();
 
+        if (Ini_Writer.SpiNand.BBM_LUT == 1) {
+            int links = spiNAND_LUT_Init(Ini_Writer.SpiNand.LUTSpare);
+            if (links < 0) {
+                printf("SPI NAND has no BBM LUT, bad blocks are skipped\n");
+                Ini_Writer.SpiNand.BBM_LUT = 0;
+            } else {
+                printf("BBM LUT: %d links, %d spare blocks per die\n", links, Ini_Writer.SpiNand.LUTSpare);
+            }
+        }
+
         if (Ini_Writer.Erase.user_choice == 1) {
-            uint8_t volatile SR;
-            uint32_t volatile blockNum, PA_Num;
             printf("EraseAll = %d\n",Ini_Writer.Erase.EraseAll);
             if (Ini_Writer.Erase.EraseAll == 1) { /* Erase whole chip */
-                for (blockNum=0; blockNum < pSN->SPINand_BlockPerFlash; blockNum++) {
-                    PA_Num = blockNum*pSN->SPINand_PagePerBlock;
-                    if(spiNAND_bad_block_check(PA_Num) == 1) {
-                        printf("bad_block:%d\n", blockNum);
-                        continue;
-                    } else {
-                        spiNAND_BlockErase( (PA_Num>>8)&0xFF, PA_Num&0xFF);
-                        SR = spiNAND_Check_Program_Erase_Fail_Flag();
-                        if (SR != 0) {
-                            spiNANDMarkBadBlock(PA_Num);
-                            printf("Error erase status! bad_block:%d\n", blockNum);
-                        } else {
-                            printf("BlockErase %d Done\n", blockNum);
-                        }
-                    }
-                }
+                spiNAND_Erase_Blocks(0, pSN->SPINand_BlockPerFlash);
             } else { /* Erase partial */
                 printf("EraseStart = %d, EraseLength = %d\n",Ini_Writer.Erase.EraseStart,Ini_Writer.Erase.EraseLength);
-                for(blockNum=Ini_Writer.Erase.EraseStart; blockNum < (Ini_Writer.Erase.EraseStart+Ini_Writer.Erase.EraseLength); blockNum++) {
-                    PA_Num = blockNum*pSN->SPINand_PagePerBlock;
-                    if (spiNAND_bad_block_check(PA_Num) == 1) {
-                        printf("bad_block:%d\n", blockNum);
-                        continue;
-                    }
-                    spiNAND_BlockErase( (PA_Num>>8)&0xFF, PA_Num&0xFF);
-                    SR = spiNAND_Check_Program_Erase_Fail_Flag();
-                    if (SR != 0) {
-                        printf("Error erase status! bad_block:%d\n", blockNum);
-                        spiNANDMarkBadBlock(PA_Num);
-                    } else {
-                        printf("BlockErase %d Done\n", blockNum);
-                    }
-                }
+                spiNAND_Erase_Blocks(Ini_Writer.Erase.EraseStart, Ini_Writer.Erase.EraseLength);
+            }
+        }
+
+        /* every image has to fit its partition before anything is burned */
+        if (Ini_Writer.UserImage[0].user_choice == 1) {
+            unsigned int blk_size = (pSN->SPINand_PagePerBlock)*(pSN->SPINand_PageSize);
+
+            for (ImgNo = 0; ImgNo < ImageCnt; ImgNo++) {
+                spiNAND_Spare_Check(ImgNo, blk_size, Image_Blocks(ImgNo, blk_size));
+                Image_Map(ImgNo, ImageCnt, blk_size, pSN->SPINand_BlockPerFlash,
+                          Image_Blocks(ImgNo, blk_size), spiNAND_Map_Usable);
             }
         }
 
         if (Ini_Writer.Loader.user_choice == 1) {
-            unsigned int i,write_len,blkindx,end_blk,page,page_count;
+            unsigned int write_len,blkindx,end_blk,page,page_count;
             unsigned char status;
             unsigned char *addr;
             int offset=0, blockCount, len;
             unsigned int header_size;
+            SPINAND_PROG_JOB_T job;
+            unsigned int scrub_blk = 0xFFFFFFFF;
 
             WDT_RSTCNT;
             printf("open [%s]\n", Ini_Writer.Loader.FileName);
@@ -1310,8 +2025,8 @@ int32_t main(void)
             if (write_len % pSN->SPINand_PageSize)
                 page_count++;
 
-            // erase block
-            end_blk = 4;
+            // every boot copy is programmed from the same Buff
+            end_blk = Ini_Writer.SpiNand.BootCopies;
             for(blkindx=0; blkindx<end_blk; blkindx++) {
 _retry_spinand_1:
                 if (blkindx > pSN->SPINand_BlockPerFlash) {
@@ -1324,17 +2039,21 @@ _retry_spinand_1:
                 addr = (unsigned char*)Buff;
                 page = pSN->SPINand_PagePerBlock * (blkindx);
                 printf("blkindx = %d   page = %d   page_count=%d\n", blkindx, page, page_count);
+                spiNAND_Erase_Sync();
                 if(spiNAND_bad_block_check(page) == 1) {
                     printf("bad block = %d\n", blkindx);
+                    if (spiNAND_Remap_Block(blkindx))
+                        goto _retry_spinand_1;
                     blkindx++;
                     end_blk++;
                     goto _retry_spinand_1;
                 } else {
-                    spiNAND_BlockErase(((page>>8)&0xFF), (page&0xFF)); // block erase
-                    status = spiNAND_Check_Program_Erase_Fail_Flag();
+                    status = spiNAND_Erase_Prepare(blkindx);
                     if (status != 0) {
                         printf("Error erase status! spiNANDMarkBadBlock blockNum = %d\n", blkindx);
                         spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                        if (spiNAND_Remap_Block(blkindx))
+                            goto _retry_spinand_1;
                         blkindx++;
                         end_blk++;
                         goto _retry_spinand_1;
@@ -1342,36 +2061,40 @@ _retry_spinand_1:
                 }
 
                 // write block
-                for (i=0; i<page_count; i++) {
-                    //printf("page+i=%d\n",page+i);
-                    WDT_RSTCNT;
-                    ETimer1_cnt = 0;
-                    ETIMER_Start(1);
-                    spiNAND_Pageprogram_Pattern(0, 0, (uint8_t*)addr, pSN->SPINand_PageSize);
-                    spiNAND_Program_Excute((((page+i)>>8)&0xFF), (page+i)&0xFF);
-                    ETIMER_Stop(1);
-                    WDT_RSTCNT;
-                    status = (spiNAND_StatusRegister(3) & 0x0C)>>2;
-                    if (status != 0) {
-                        spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
-                        printf("Error write status! Bad block[%d]!\n",blkindx);
-                        blkindx++;
-                        end_blk++;
+                job.Page = page;
+                job.Buff = (uint8_t*)addr;
+                job.PageCount = page_count;
+                job.SkipBlank = 0;
+                WDT_RSTCNT;
+                ETimer1_cnt = 0;
+                ETIMER_Start(1);
+                status = spiNAND_Program_Interleave(&job, 1);
+                ETIMER_Stop(1);
+                WDT_RSTCNT;
+                if (status == 0) {
+                    status = spiNAND_Verify(blkindx, job.Buff, job.PageCount, blkindx == scrub_blk);
+                    if (status == 1) {
+                        scrub_blk = blkindx;
                         goto _retry_spinand_1;
                     }
-                    addr += pSN->SPINand_PageSize;
-                    //pagetmp++;
                 }
+                if (status != 0) {
+                    spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                    printf("Error write status! Bad block[%d]!\n",blkindx);
+                    if (spiNAND_Remap_Block(blkindx))
+                        goto _retry_spinand_1;
+                    blkindx++;
+                    end_blk++;
+                    goto _retry_spinand_1;
+                }
+                if (blkindx+1 < end_blk)
+                    spiNAND_Erase_Ahead(blkindx+1);
             }
             f_close(&file2);
             printf("Write [%s] to SPI NAND flash ... done\n",Ini_Writer.Loader.FileName);
         }
 
         if (Ini_Writer.UserImage[0].user_choice == 1) {
-            unsigned int i,blkindx,startblk,endblk,page,blk_count,page_count,remain_size,len;
-            unsigned char status;
-            unsigned int addr;
-
             for (ImgNo = 0; ImgNo < ImageCnt; ImgNo++) {
                 WDT_RSTCNT;
                 printf("open [%s]\n", Ini_Writer.UserImage[ImgNo].FileName);
@@ -1384,86 +2107,18 @@ _retry_spinand_1:
 
                 //Burn to SPI NAND flash
                 printf("Write [%s] to SPI NAND flash offset [0x%x] ... start\n", Ini_Writer.UserImage[ImgNo].FileName,Ini_Writer.UserImage[ImgNo].address);
-
-                blk_count = Ini_Writer.UserImage[ImgNo].DataSize/(pSN->SPINand_PagePerBlock * pSN->SPINand_PageSize);
-                printf("Img[%d] size = %d, blk_count = %d\n",ImgNo,Ini_Writer.UserImage[ImgNo].DataSize,blk_count);
-
-                startblk = Ini_Writer.UserImage[ImgNo].address/((pSN->SPINand_PagePerBlock) * (pSN->SPINand_PageSize));
-                endblk = startblk + (Ini_Writer.UserImage[ImgNo].DataSize/((pSN->SPINand_PagePerBlock)*(pSN->SPINand_PageSize)));
-                printf("startblk = %d, endblk = %d\n",startblk,endblk);
-
-                page_count = pSN->SPINand_PagePerBlock;
-
-                // erase block
-                for(blkindx = startblk; blkindx <= endblk; blkindx++) {
-                    len = MIN(((pSN->SPINand_PagePerBlock)*(pSN->SPINand_PageSize)), Ini_Writer.UserImage[ImgNo].DataSize);
-                    memset((void*)Buff, 0xFF, BUFF_SIZE);
-                    res = f_read(&file2, Buff, len, &s2);
-                    //printf("len = %d, s2 = %d\n",len,s2);
-                    if (res) {
-                        printf("res = %d,read size = %d\n",res,s2);
-                        while(1) {   /* error or eof */
-                            WDT_RSTCNT;
-                        }
-                    }
-_retry_spinand_2:
-                    if (blkindx > pSN->SPINand_BlockPerFlash) {
-                        printf("Write out of SPI NAND flash! blkindx[%d], BlockPerFlash = %d\n", blkindx, pSN->SPINand_BlockPerFlash);
-                        while(1) {
-                            WDT_RSTCNT;
-                        }
-                    }
-                    WDT_RSTCNT;
-                    page = pSN->SPINand_PagePerBlock * (blkindx);
-                    addr = (unsigned int)Buff;
-                    printf("blkindx = %d   page = %d   page_count=%d\n", blkindx, page, page_count);
-                    if(spiNAND_bad_block_check(page) == 1) {
-                        printf("bad block = %d\n", blkindx);
-                        blkindx++;
-                        endblk++;
-                        goto _retry_spinand_2;
-                    } else {
-                        spiNAND_BlockErase(((page>>8)&0xFF), (page&0xFF)); // block erase
-                        status = spiNAND_Check_Program_Erase_Fail_Flag();
-                        if (status != 0) {
-                            printf("Error erase status! spiNANDMarkBadBlock blockNum = %d\n", blkindx);
-                            spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
-                            blkindx++;
-                            endblk++;
-                            goto _retry_spinand_2;
-                        }
-                    }
-                    // write block
-                    for (i=0; i<pSN->SPINand_PagePerBlock; i++) {
-                        //printf("page+i=%d\n",page+i);
-                        WDT_RSTCNT;
-
-                        ETimer1_cnt = 0;
-                        ETIMER_Start(1);
-                        spiNAND_Pageprogram_Pattern(0, 0, (uint8_t*)addr, pSN->SPINand_PageSize);
-                        spiNAND_Program_Excute((((page+i)>>8)&0xFF), (page+i)&0xFF);
-                        ETIMER_Stop(1);
-                        WDT_RSTCNT;
-                        status = (spiNAND_StatusRegister(3) & 0x0C)>>2;
-                        if (status != 0) {
-                            spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
-                            printf("Error write status! Bad block[%d]!\n",blkindx);
-                            blkindx++;
-                            endblk++;
-                            goto _retry_spinand_2;
-                        }
-                        addr += pSN->SPINand_PageSize;
-                    }
-                }
+                spiNAND_Write_Image(ImgNo, ImageCnt);
                 f_close(&file2);
                 printf("Write [%s] to SPI NAND flash ... done\n",Ini_Writer.UserImage[ImgNo].FileName);
             }
         }
 
         if (Ini_Writer.Env.user_choice == 1) {
-            unsigned int i,blkindx,page,page_count;
+            unsigned int blkindx,page,page_count;
             unsigned char status;
             unsigned int addr;
+            SPINAND_PROG_JOB_T job;
+            unsigned int scrub_blk = 0xFFFFFFFF;
 
             WDT_RSTCNT;
             printf("open [%s]\n",Ini_Writer.Env.FileName);
@@ -1511,41 +2166,55 @@ _retry_spinand_3:
             addr = (unsigned int)pENV;
             page = pSN->SPINand_PagePerBlock * (blkindx);
             printf("blkindx = %d   page = %d   page_count=%d\n", blkindx, page, page_count);
+            spiNAND_Erase_Sync();
             if(spiNAND_bad_block_check(page) == 1) {
                 printf("bad block = %d\n", blkindx);
+                if (spiNAND_Remap_Block(blkindx))
+                    goto _retry_spinand_3;
                 blkindx++;
                 goto _retry_spinand_3;
             } else {
-                spiNAND_BlockErase(((page>>8)&0xFF), (page&0xFF)); // block erase
-                status = spiNAND_Check_Program_Erase_Fail_Flag();
+                status = spiNAND_Erase_Prepare(blkindx);
                 if (status != 0) {
                     printf("Error erase status! spiNANDMarkBadBlock blockNum = %d\n", blkindx);
                     spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                    if (spiNAND_Remap_Block(blkindx))
+                        goto _retry_spinand_3;
                     blkindx++;
                     goto _retry_spinand_3;
                 }
             }
             // write block
-            for (i=0; i<page_count; i++) {
-                //printf("page+i=%d\n",page+i);
-                WDT_RSTCNT;
-                ETimer1_cnt = 0;
-                ETIMER_Start(1);
-                spiNAND_Pageprogram_Pattern(0, 0, (uint8_t*)addr, pSN->SPINand_PageSize);
-                spiNAND_Program_Excute((((page+i)>>8)&0xFF), (page+i)&0xFF);
-                ETIMER_Stop(1);
-                WDT_RSTCNT;
-                status = (spiNAND_StatusRegister(3) & 0x0C)>>2;
-                if (status != 0) {
-                    spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
-                    printf("Error write status! Bad block[%d]!\n",blkindx);
-                    blkindx++;
+            job.Page = page;
+            job.Buff = (uint8_t*)addr;
+            job.PageCount = page_count;
+            job.SkipBlank = 0;
+            WDT_RSTCNT;
+            ETimer1_cnt = 0;
+            ETIMER_Start(1);
+            status = spiNAND_Program_Interleave(&job, 1);
+            ETIMER_Stop(1);
+            WDT_RSTCNT;
+            if (status == 0) {
+                status = spiNAND_Verify(blkindx, job.Buff, job.PageCount, blkindx == scrub_blk);
+                if (status == 1) {
+                    scrub_blk = blkindx;
                     goto _retry_spinand_3;
                 }
-                addr += pSN->SPINand_PageSize;
+            }
+            if (status != 0) {
+                spiNANDMarkBadBlock(blkindx*pSN->SPINand_PagePerBlock);
+                printf("Error write status! Bad block[%d]!\n",blkindx);
+                if (spiNAND_Remap_Block(blkindx))
+                    goto _retry_spinand_3;
+                blkindx++;
+                goto _retry_spinand_3;
             }
             printf("Write Environment variable to SPI NAND flash ... done\n");
         }
+
+        spiNAND_Erase_Sync();
+        spiNAND_ECC_Report();
     }
     if (Ini_Writer.Type == TYPE_NAND) {
         uint32_t chip_size;
@@ -1557,6 +2226,7 @@ _retry_spinand_3:
         printf("UXmodem_NAND BlockPerFlash=%d\n",pSM->uBlockPerFlash);
         printf("UXmodem_NAND PagePerBlock=%d\n",pSM->uPagePerBlock);
         printf("UXmodem_NAND PageSize=%d\n",pSM->uPageSize);
+        printf("UXmodem_NAND BadBlockCount=%d\n",pSM->uBadBlockCount);
         memset((char *)&nandImage, 0, sizeof(FW_NAND_IMAGE_T));
         pNandImage = (FW_NAND_IMAGE_T *)&nandImage;
 
@@ -1580,93 +2250,129 @@ _retry_spinand_3:
             }
         }
 
+        /* every image has to fit its partition before anything is burned */
+        if (Ini_Writer.UserImage[0].user_choice == 1) {
+            for (ImgNo = 0; ImgNo < ImageCnt; ImgNo++)
+                Image_Map(ImgNo, ImageCnt, (pSM->uPagePerBlock)*(pSM->uPageSize), pSM->uBlockPerFlash,
+                          Image_Blocks(ImgNo, (pSM->uPagePerBlock)*fmiSM_PageStride(fmiSM_Image_Oob(ImgNo))), fmiSM_Map_Usable);
+        }
+
         if (Ini_Writer.Loader.user_choice == 1) {
-            unsigned int header_size;
-            int blkindx,page,status,i,page_count,end_blk;
+            unsigned int header_size,len,addr,copies;
+            int blkindx,page,status,i,page_count,copy;
 
             //Burn Loader to NAND flash
             WDT_RSTCNT;
             printf("Write [%s] to NAND flash ... start\n",Ini_Writer.Loader.FileName);
-            Form_BootCode_Header(&header_size);
-            page_count = (Ini_Writer.Loader_size + header_size)/pSM->uPageSize;
-            end_blk = 4;
-            for(blkindx=0; blkindx<end_blk; blkindx++) {
-                unsigned int len,addr;
-                printf("open SPL [%s]\n", Ini_Writer.Loader.FileName);
-                res = f_open(&file2, Ini_Writer.Loader.FileName, FA_OPEN_EXISTING | FA_READ);
-                if (res)
-                    printf("result = %d\n",res);
-                else
-                    printf("f_open SPL [%s] ok\n", Ini_Writer.Loader.FileName);
+            printf("open SPL [%s]\n", Ini_Writer.Loader.FileName);
+            res = f_open(&file2, Ini_Writer.Loader.FileName, FA_OPEN_EXISTING | FA_READ);
+            if (res)
+                printf("result = %d\n",res);
+            else
+                printf("f_open SPL [%s] ok\n", Ini_Writer.Loader.FileName);
 
-                len = MIN(((pSM->uPagePerBlock)*(pSM->uPageSize)), Ini_Writer.Loader_size);
-                res = f_read(&file2, Buff + header_size, len, &s2);
-                if (res) {
-                    printf("res = %d,read size = %d\n",res,s2);
-                    while(1) {   /* error or eof */
-                        WDT_RSTCNT;
-                    }
+            // header and loader are assembled once, every boot copy is programmed from Buff
+            Form_BootCode_Header(&header_size);
+            len = MIN(((pSM->uPagePerBlock)*(pSM->uPageSize)), Ini_Writer.Loader_size);
+            res = f_read(&file2, Buff + header_size, len, &s2);
+            if (res) {
+                printf("res = %d,read size = %d\n",res,s2);
+                while(1) {   /* error or eof */
+                    WDT_RSTCNT;
                 }
-_retry_1:
-                if (blkindx > pSM->uBlockPerFlash) {
+            }
+            f_close(&file2);
+
+            // data that is less than a page takes one more page
+            page_count = (Ini_Writer.Loader_size + header_size)/pSM->uPageSize;
+            if ((Ini_Writer.Loader_size + header_size) % pSM->uPageSize)
+                page_count++;
+            addr = (unsigned int)Buff;
+            copies = Ini_Writer.Nand.BootCopies;
+            copy = 0;
+            blkindx = 0;
+            while (copy < copies) {
+                WDT_RSTCNT;
+                if (blkindx >= pSM->uBlockPerFlash) {
                     printf("Write out of NAND flash!\n");
                     while(1) {
                         WDT_RSTCNT;
                     }
                 }
-                page = pSM->uPagePerBlock * (blkindx);
-                addr = (unsigned int)Buff;
-                printf("Erase block [%d]\n",blkindx);
-                status = fmiSM_BlockErase(pSM, blkindx);
-                if (status != 0) {
-                    fmiMarkBadBlock(pSM, blkindx);
-                    printf("Bad block [%d]\n",blkindx);
-                    blkindx++;
-                    end_blk++;
-                    goto _retry_1;
-                }
 
-                // write block
-                for (i=0; i<page_count; i++) {
-                    //printf("write page [%d]\n",page+i);
-                    ETimer1_cnt = 0;
-                    ETIMER_Start(1);
-                    status = fmiSM_Write_large_page(page+i, 0, addr);
-                    ETIMER_Stop(1);
-                    if (status != 0) {
-                        fmiMarkBadBlock(pSM, blkindx);
-                        printf("Bad block [%d]\n",blkindx);
-                        blkindx++;
-                        end_blk++;
-                        goto _retry_1;
+                /* multi-plane: two copies in blkindx and blkindx+1 */
+                if ((copy+1 < copies) && fmiSM_PlanePair(pSM, blkindx)) {
+                    printf("Erase block [%d][%d] multi-plane\n",blkindx,blkindx+1);
+                    status = fmiSM_BlockPrepare_Plane2(pSM, blkindx);
+                    if (status == 0) {
+                        ETimer1_cnt = 0;
+                        ETIMER_Start(1);
+                        status = fmiSM_Write_Pages_Plane2(blkindx, page_count, addr, addr);
+                        ETIMER_Stop(1);
+                    }
+                    if (status == 0) {
+                        for (i = blkindx; i < blkindx+2; i++) {
+                            if (fmiSM_Verify(i, addr, page_count, NAND_OOB_MARKER) == 0) {
+                                copy++;
+                            } else {
+                                fmiMarkBadBlock(pSM, i);
+                                printf("Bad block [%d]\n",i);
+                            }
+                        }
+                        blkindx += 2;
+                        if (copy < copies)
+                            fmiSM_EraseAhead(pSM, blkindx);
+                        continue;
                     }
-                    addr += pSM->uPageSize;
+                    printf("Multi-plane block [%d][%d] fail, write one by one\n",blkindx,blkindx+1);
                 }
-                //Write remaining data that is less than a page
-                printf("write remaining [%d] byte to page[%d]\n",(Ini_Writer.Loader_size + header_size) % pSM->uPageSize,page_count);
-                if ((Ini_Writer.Loader_size + header_size) % pSM->uPageSize) {
+
+                page = pSM->uPagePerBlock * (blkindx);
+                printf("Erase block [%d]%s\n",blkindx,fmiSM_IsClean(blkindx) ? " skipped, clean" : "");
+                status = fmiSM_BlockPrepare(pSM, blkindx);
+                if (status == 0) {
                     ETimer1_cnt = 0;
                     ETIMER_Start(1);
-                    status = fmiSM_Write_large_page(page+page_count, 0, addr);
+                    status = fmiSM_Write_Pages(page, page_count, addr);
                     ETIMER_Stop(1);
-                    if (status != 0) {
-                        fmiMarkBadBlock(pSM, blkindx);
-                        printf("Bad block [%d]\n",blkindx);
-                        blkindx++;
-                        end_blk++;
-                        goto _retry_1;
-                    }
                 }
-                f_close(&file2);
+                if (status == 0)
+                    status = fmiSM_Verify(blkindx, addr, page_count, NAND_OOB_MARKER);
+                if (status != 0) {
+                    fmiMarkBadBlock(pSM, blkindx);
+                    printf("Bad block [%d]\n",blkindx);
+                } else {
+                    copy++;
+                }
+                blkindx++;
+                if (copy < copies)
+                    fmiSM_EraseAhead(pSM, blkindx);
             }
             printf("Write [%s] to NAND flash ... done\n",Ini_Writer.Loader.FileName);
         }
 
         if (Ini_Writer.UserImage[0].user_choice == 1) {
-            unsigned int addr;
-            int blkindx,startblk,endblk,page,status,i;
+            unsigned int addr, blk_size, raw_size, preload, oob, len, lblk, nblk;
+            int blkindx,page,status,k,nmap;
+
+            blk_size = (pSM->uPagePerBlock)*(pSM->uPageSize);
             for (ImgNo = 0; ImgNo < ImageCnt; ImgNo++) {
                 WDT_RSTCNT;
+                oob = fmiSM_Image_Oob(ImgNo);
+                raw_size = (pSM->uPagePerBlock)*fmiSM_PageStride(oob);   // image bytes per block
+                if (raw_size > 512*1024) {
+                    printf("Image [%s]: block with spare area does not fit the buffer!\n", Ini_Writer.UserImage[ImgNo].FileName);
+                    while(1) {
+                        WDT_RSTCNT;
+                    }
+                }
+                if ((oob == NAND_OOB_TAGS) && (fmiSM_OobFree() < 16)) {
+                    printf("Image [%s]: %d free spare bytes, no room for YAFFS2 tags!\n", Ini_Writer.UserImage[ImgNo].FileName, fmiSM_OobFree());
+                    while(1) {
+                        WDT_RSTCNT;
+                    }
+                }
+
                 printf("open [%s]\n", Ini_Writer.UserImage[ImgNo].FileName);
                 res = f_open(&file2, Ini_Writer.UserImage[ImgNo].FileName, FA_OPEN_EXISTING | FA_READ);
                 if (res)
@@ -1677,71 +2383,124 @@ _retry_1:
                 //Burn to NAND flash
                 printf("Write [%s] size [%d] to NAND flash offset [0x%x] ... start\n", Ini_Writer.UserImage[ImgNo].FileName, Ini_Writer.UserImage[ImgNo].DataSize, Ini_Writer.UserImage[ImgNo].address);
 
-                startblk = Ini_Writer.UserImage[ImgNo].address/((pSM->uPagePerBlock)*(pSM->uPageSize));
-                endblk = startblk + (Ini_Writer.UserImage[ImgNo].DataSize/((pSM->uPagePerBlock)*(pSM->uPageSize)));
-                printf("startblk[%d], endblk[%d]\n",startblk,endblk);
-                for(blkindx = startblk; blkindx <= endblk; blkindx++) {
-                    unsigned int len;
+                nblk = Image_Blocks(ImgNo, raw_size);
+                nmap = Image_Map(ImgNo, ImageCnt, blk_size, pSM->uBlockPerFlash, nblk, fmiSM_Map_Usable);
+                printf("blocks[%d], good blocks in partition[%d]\n",nblk,nmap);
+                preload = 0;
+                k = 0;
+                for(lblk = 0; lblk < nblk; lblk++) {
                     WDT_RSTCNT;
-                    len = MIN(((pSM->uPagePerBlock)*(pSM->uPageSize)), Ini_Writer.UserImage[ImgNo].DataSize);
-                    memset((void*)Block_Buff, 0xFF, 512*1024);
-                    res = f_read(&file2, Block_Buff, len, &s2);
-                    if (res) {
-                        printf("res = %d,read size = %d\n",res,s2);
-                        while(1) {   /* error or eof */
+                    len = raw_size;
+                    if (preload) {  // data of the second block of a failed plane pair
+                        memcpy((void*)Block_Buff, (void*)(Block_Buff + blk_size), blk_size);
+                        preload = 0;
+                    } else {
+                        memset((void*)Block_Buff, 0xFF, 512*1024);
+                        res = f_read(&file2, Block_Buff, len, &s2);
+                        if (res) {
+                            printf("res = %d,read size = %d\n",res,s2);
+                            while(1) {   /* error or eof */
+                                WDT_RSTCNT;
+                            }
+                        }
+                    }
+                    blkindx = BlockMap[k];
+
+                    /* multi-plane: erase and program blkindx and blkindx+1 together */
+                    if ((oob == NAND_OOB_MARKER) && (lblk+1 < nblk) && (k+1 < nmap) && (BlockMap[k+1] == blkindx+1) &&
+                        (blk_size*2 <= 512*1024) && fmiSM_PlanePair(pSM, blkindx)) {
+                        memset((void*)(Block_Buff + blk_size), 0xFF, blk_size);
+                        res = f_read(&file2, Block_Buff + blk_size, len, &s2);
+                        if (res) {
+                            printf("res = %d,read size = %d\n",res,s2);
+                            while(1) {   /* error or eof */
+                                WDT_RSTCNT;
+                            }
+                        }
+                        printf("Erase block [%d][%d] multi-plane\n",blkindx,blkindx+1);
+                        status = fmiSM_BlockPrepare_Plane2(pSM, blkindx);
+                        if (status == 0) {
+                            ETimer1_cnt = 0;
+                            ETIMER_Start(1);
+                            status = fmiSM_Write_Pages_Plane2(blkindx, pSM->uPagePerBlock, (UINT32)Block_Buff, (UINT32)(Block_Buff + blk_size));
+                            ETIMER_Stop(1);
                             WDT_RSTCNT;
                         }
+                        if ((status == 0) && (fmiSM_Verify(blkindx, (UINT32)Block_Buff, pSM->uPagePerBlock, NAND_OOB_MARKER) != 0)) {
+                            // data of blkindx moves to blkindx+1, then the second block follows it
+                            fmiMarkBadBlock(pSM, blkindx);
+                            printf("Bad block [%d]\n",blkindx);
+                            preload = 1;
+                            k++;
+                            goto _retry_2;
+                        }
+                        if ((status == 0) && (fmiSM_Verify(blkindx+1, (UINT32)(Block_Buff + blk_size), pSM->uPagePerBlock, NAND_OOB_MARKER) != 0)) {
+                            // data of blkindx+1 moves to the block after the pair
+                            fmiMarkBadBlock(pSM, blkindx+1);
+                            printf("Bad block [%d]\n",blkindx+1);
+                            memcpy((void*)Block_Buff, (void*)(Block_Buff + blk_size), blk_size);
+                            lblk++;
+                            k += 2;
+                            goto _retry_2;
+                        }
+                        if (status == 0) {
+                            lblk++;
+                            k += 2;
+                            if ((lblk+1 < nblk) && (k < nmap))
+                                fmiSM_EraseAhead(pSM, BlockMap[k]);
+                            continue;
+                        }
+                        printf("Multi-plane block [%d][%d] fail, write one by one\n",blkindx,blkindx+1);
+                        preload = 1;
                     }
 _retry_2:
-
-                    if (blkindx > pSM->uBlockPerFlash) {
-                        printf("Write out of NAND flash!\n");
+                    if (k >= nmap) {
+                        printf("Image [%s] does not fit its partition, too many bad blocks!\n", Ini_Writer.UserImage[ImgNo].FileName);
                         while(1) {
                             WDT_RSTCNT;
                         }
                     }
+                    blkindx = BlockMap[k];
                     page = pSM->uPagePerBlock * (blkindx);
-                    printf("Erase block [%d]\n",blkindx);
-                    status = fmiSM_BlockErase(pSM, blkindx);
+                    printf("Erase block [%d]%s\n",blkindx,fmiSM_IsClean(blkindx) ? " skipped, clean" : "");
+                    status = fmiSM_BlockPrepare(pSM, blkindx);
                     if (status != 0) {
                         fmiMarkBadBlock(pSM, blkindx);
                         printf("Bad block [%d]\n",blkindx);
-                        blkindx++;
-                        endblk++;
+                        k++;
                         goto _retry_2;
                     }
 
                     // write block
-                    // read BUFF_SIZE one time
-                    page = blkindx*(pSM->uPagePerBlock);
                     addr = (unsigned int)Block_Buff;
-                    for (i=0; i<pSM->uPagePerBlock; i++) {
-                        //printf("write page[%d]\n",page+i);
-                        ETimer1_cnt = 0;
-                        ETIMER_Start(1);
-                        status = fmiSM_Write_large_page(page+i, 0, addr);
-                        ETIMER_Stop(1);
-                        WDT_RSTCNT;
-                        if (status != 0) {
-                            fmiMarkBadBlock(pSM, blkindx);
-                            printf("Bad block [%d]\n",blkindx);
-                            blkindx++;
-                            endblk++;
-                            goto _retry_2;
-                        }
-                        addr += pSM->uPageSize;
-                        //pagetmp++;
+                    ETimer1_cnt = 0;
+                    ETIMER_Start(1);
+                    // pages of all 0xFF (padding, free space, the rest of a UBI PEB) are left erased
+                    status = fmiSM_Write_Pages_Skip(page, pSM->uPagePerBlock, addr, oob);
+                    ETIMER_Stop(1);
+                    WDT_RSTCNT;
+                    if (status == 0)
+                        status = fmiSM_Verify(blkindx, addr, pSM->uPagePerBlock, oob);
+                    if (status != 0) {
+                        fmiMarkBadBlock(pSM, blkindx);
+                        printf("Bad block [%d]\n",blkindx);
+                        k++;
+                        goto _retry_2;
                     }
+                    k++;
+                    if ((lblk+1 < nblk) && (k < nmap))
+                        fmiSM_EraseAhead(pSM, BlockMap[k]);
                 }
 
                 f_close(&file2);
+                fmiSM_EraseSync();
                 printf("Write [%s] to NAND flash ... done\n", Ini_Writer.UserImage[ImgNo].FileName);
             }
         }
 
         if (Ini_Writer.Env.user_choice == 1) {
             unsigned int addr;
-            int blkindx,page,status,i,page_count;
+            int blkindx,page,status,page_count;
 
             WDT_RSTCNT;
             printf("open [%s]\n",Ini_Writer.Env.FileName);
@@ -1784,8 +2543,8 @@ _retry_3:
                 }
             }
             page = pSM->uPagePerBlock * (blkindx);
-            printf("Erase block [%d]\n",blkindx);
-            status = fmiSM_BlockErase(pSM, blkindx);
+            printf("Erase block [%d]%s\n",blkindx,fmiSM_IsClean(blkindx) ? " skipped, clean" : "");
+            status = fmiSM_BlockPrepare(pSM, blkindx);
             if (status != 0) {
                 fmiMarkBadBlock(pSM, blkindx);
                 blkindx++;
@@ -1793,26 +2552,24 @@ _retry_3:
             }
 
             // write block
-            for (i=0; i<page_count; i++) {
-                //printf("write page [%d]\n",page+i);
-                ETimer1_cnt = 0;
-                ETIMER_Start(1);
-                status = fmiSM_Write_large_page(page+i, 0, addr);
-                ETIMER_Stop(1);
-                if (status != 0) {
-                    fmiMarkBadBlock(pSM, blkindx);
-                    printf("Bad block [%d]\n",blkindx);
-                    blkindx++;
-                    goto _retry_3;
-                }
-                addr += pSM->uPageSize;
-                //pagetmp++;
+            ETimer1_cnt = 0;
+            ETIMER_Start(1);
+            status = fmiSM_Write_Pages(page, page_count, addr);
+            ETIMER_Stop(1);
+            if (status == 0)
+                status = fmiSM_Verify(blkindx, addr, page_count, NAND_OOB_MARKER);
+            if (status != 0) {
+                fmiMarkBadBlock(pSM, blkindx);
+                printf("Bad block [%d]\n",blkindx);
+                blkindx++;
+                goto _retry_3;
             }
             printf("Write Environment variable to NAND flash ... done\n");
         }
+        fmiSM_ECC_Report();
     }
     if (Ini_Writer.Type == TYPE_EMMC) {
-        int eMMCBlockSize, len;
+        int eMMCBlockSize;
 
         printf("Write Type is EMMC\n");
         /* initial eMMC */
@@ -1821,15 +2578,17 @@ _retry_3:
             info.EMMC_uReserved=GetMMCReserveSpace();
             printf("eMMC_uReserved =%d ...\n",info.EMMC_uReserved);
             info.EMMC_uBlock=eMMCBlockSize;
+            eMMC_Unit = SD_MMC_WriteUnit(BUFF_SIZE);
+            printf("eMMC write unit = %d bytes\n", eMMC_Unit);
+            /* bulk data through the volatile cache, flushed at every image boundary */
+            if (SD_MMC_CacheCtrl(pSD0, TRUE) == Successful)
+                printf("eMMC cache on\n");
         }
 
         printf("eMMCBlockSize=0x%08x(%d) \n",eMMCBlockSize, eMMCBlockSize);
 
         if (Ini_Writer.EMMC_Format.user_choice == 1) {
             PMBR pmbr;
-            unsigned int *ptr;
-            UCHAR _fmi_ucBuffer[512];
-            ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
 
             printf("Format eMMC !!!\n");
             printf("Reserved space: [%d] sector\n",Ini_Writer.EMMC_Format.ReservedSpace);
@@ -1838,6 +2597,8 @@ _retry_3:
             printf("Partition 2 size: [%d] MB\n",Ini_Writer.EMMC_Format.Partition2Size);
             printf("Partition 3 size: [%d] MB\n",Ini_Writer.EMMC_Format.Partition3Size);
             printf("Partition 4 size: [%d] MB\n",Ini_Writer.EMMC_Format.Partition4Size);
+            if (Ini_Writer.EMMC_Format.GPT == 1)
+                printf("GPT, %d partition lines\n",Ini_Writer.EMMC_Format.PartCount);
 
             memset((char *)&mmcImage, 0, sizeof(FW_MMC_IMAGE_T));
             pmmcImage = (FW_MMC_IMAGE_T*)&mmcImage;
@@ -1848,7 +2609,40 @@ _retry_3:
             pmmcImage->Partition3Size = Ini_Writer.EMMC_Format.Partition3Size;
             pmmcImage->Partition4Size = Ini_Writer.EMMC_Format.Partition4Size;
 
-            if(eMMCBlockSize>0) {
+            if((eMMCBlockSize>0) && (Ini_Writer.EMMC_Format.GPT == 1)) {
+                FW_MMC_PART_T *pPart = Ini_Writer.EMMC_Format.Part;
+                unsigned int PartCount = Ini_Writer.EMMC_Format.PartCount;
+                unsigned int i;
+
+                if (PartCount == 0) {
+                    /* no Part= line, FAT partitions from the four sizes, the last one takes the rest */
+                    unsigned int *pSize = &Ini_Writer.EMMC_Format.Partition1Size;
+
+                    PartCount = MIN(pmmcImage->PartitionNum, 4);
+                    for (i=0; i<PartCount; i++) {
+                        memset(&pPart[i], 0, sizeof(FW_MMC_PART_T));
+                        sprintf(pPart[i].Name, "part%d", i+1);
+                        pPart[i].Type = MMC_PART_FAT;
+                        pPart[i].Size = (i == PartCount-1) ? 0 : pSize[i];
+                    }
+                }
+                if (create_gpt(eMMCBlockSize, pmmcImage, pPart, PartCount) != 0) {
+                    printf("GPT format rejected, set ReservedSpace in [Format]\n");
+                    while(1) {
+                        WDT_RSTCNT;
+                    }
+                }
+                for (i=0; i<PartCount; i++) {
+                    if ((pPart[i].Type == MMC_PART_FAT) && (pPart[i].SectorCount != 0)) {
+                        ETimer1_cnt = 0;
+                        FormatFatRange(pPart[i].FirstSector, pPart[i].SectorCount);
+                    }
+                }
+
+                /* GPT header is in MMC_INFO_SECTOR, keep the reserve marker behind it */
+                ReloadMMCInfo();
+                SetMMCReserveSpace(pmmcImage->ReserveSize);
+            } else if(eMMCBlockSize>0) {
                 pmbr=create_mbr(eMMCBlockSize, pmmcImage);
                 switch(pmmcImage->PartitionNum) {
                 case 1:
@@ -1880,12 +2674,9 @@ _retry_3:
                 break;
                 }
 
-                fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
-                *(ptr+125)=0x11223344;
-                *(ptr+126)=pmmcImage->ReserveSize;
-                *(ptr+127)=0x44332211;
-                fmiSD_Write(MMC_INFO_SECTOR,1,(UINT32)ptr);
+                SetMMCReserveSpace(pmmcImage->ReserveSize);
             }
+            fmiSD_Flush();
         }
         if (Ini_Writer.Loader.user_choice == 1) {
             unsigned int header_size;
@@ -1902,53 +2693,24 @@ _retry_3:
             //Burn Loader to eMMC
             printf("Write [%s] to eMMC ... start\n",Ini_Writer.Loader.FileName);
             Form_BootCode_Header(&header_size);
-
-            res = f_read(&file2, Buff + header_size, (EMMC_BLOCK_SIZE - header_size), &s2);
-            if (res || s2 == 0) {
-                printf("res = %d,read size = %d\n",res,s2);
-                while(1) {   /* error or eof */
-                    WDT_RSTCNT;
-                }
-            }
-            fmiSD_Write((0x400/SD_SECTOR),(s2 + header_size)/SD_SECTOR,(UINT32)Buff);
-            offset += EMMC_BLOCK_SIZE;
-            //Write remain part of loader
-            len = Ini_Writer.Loader_size - (EMMC_BLOCK_SIZE - header_size);
-            if (len > 0) {
-                int read_idx, read_count;
-                read_count = len / EMMC_BLOCK_SIZE;
-                for (read_idx = 0; read_idx < read_count; read_idx++) {
-                    WDT_RSTCNT;
-                    res = f_read(&file2, Buff, EMMC_BLOCK_SIZE, &s2);
-                    if (res || s2 == 0) {
-                        printf("res = %d,read size = %d\n",res,s2);
-                        while(1) {   /* error or eof */
-                            WDT_RSTCNT;
-                        }
-                    }
-                    ETimer1_cnt = 0;
-                    ETIMER_Start(1);
-                    fmiSD_Write((offset/SD_SECTOR),EMMC_BLOCK_SIZE/SD_SECTOR,(UINT32)Buff);
-                    ETIMER_Stop(1);
-                    WDT_RSTCNT;
-                    offset += EMMC_BLOCK_SIZE;
-                }
-                //Write the last part of loader that is less than EMMC_BLOCK_SIZE
-                if (len % EMMC_BLOCK_SIZE) {
-                    res = f_read(&file2, Buff, len - (read_count * EMMC_BLOCK_SIZE), &s2);
-                    if (res || s2 == 0) {
-                        printf("res = %d,read size = %d\n",res,s2);
-                        while(1) {   /* error or eof */
-                            WDT_RSTCNT;
-                        }
+            if (Ini_Writer.Emmc.BootPartition == 1)
+                eMMC_Write_Boot(offset, Ini_Writer.Loader_size, header_size);
+            else {
+                /* a boot partition left enabled would shadow the new loader */
+                unsigned int boot = (_sd_ucExtCSD[179] >> 3) & 0x7;
+
+                if ((boot == EMMC_ACCESS_BOOT0) || (boot == EMMC_ACCESS_BOOT1)) {
+                    if (Ini_Writer.Emmc.BootUser == 1) {
+                        printf("PARTITION_CONFIG 0x%x: boot partition %d disabled\n", _sd_ucExtCSD[179], boot);
+                        SD_MMC_SetBoot(pSD0, 0, _sd_ucExtCSD[177]);
+                    } else {
+                        printf("PARTITION_CONFIG 0x%x: device boots from boot partition %d, set BootUser=1 in [eMMC] to boot this loader\n",
+                               _sd_ucExtCSD[179], boot);
                     }
-                    ETimer1_cnt = 0;
-                    ETIMER_Start(1);
-                    fmiSD_Write((offset/SD_SECTOR),s2/SD_SECTOR,(UINT32)Buff);
-                    ETIMER_Stop(1);
-                    WDT_RSTCNT;
                 }
+                eMMC_Write_File(offset, Ini_Writer.Loader_size, header_size);
             }
+            fmiSD_Flush();
         }
 
         printf("Write [%s] to eMMC ... done\n",Ini_Writer.Loader.FileName);
@@ -1964,40 +2726,14 @@ _retry_3:
                 else
                     printf("f_open [%s] ok\n", Ini_Writer.UserImage[ImgNo].FileName);
 
-                if (1) {
-                    int i, offset=0, read_count, read_idx;
-                    unsigned int len;
-                    len = Ini_Writer.UserImage[ImgNo].DataSize;
-                    read_count = len / EMMC_BLOCK_SIZE;
-                    offset = Ini_Writer.UserImage[ImgNo].address;
-
-                    for (read_idx = 0; read_idx < read_count; read_idx++) {
-                        WDT_RSTCNT;
-                        res = f_read(&file2, Buff, EMMC_BLOCK_SIZE, &s2);
-                        if (res || s2 == 0) {
-                            printf("res = %d,read size = %d\n",res,s2);
-                            while(1) {   /* error or eof */
-                                WDT_RSTCNT;
-                            }
-                        }
-                        fmiSD_Write((offset/SD_SECTOR),(EMMC_BLOCK_SIZE)/SD_SECTOR,(UINT32)Buff);
-                        offset += EMMC_BLOCK_SIZE;
-                    }
-                    if (len % EMMC_BLOCK_SIZE) {
-                        WDT_RSTCNT;
-                        res = f_read(&file2, Buff, len - (read_count*EMMC_BLOCK_SIZE), &s2);
-                        if (res || s2 == 0) {
-                            printf("res = %d,read size = %d\n",res,s2);
-                            while(1) {   /* error or eof */
-                                WDT_RSTCNT;
-                            }
-                        }
-                        ETimer1_cnt = 0;
-                        ETIMER_Start(1);
-                        fmiSD_Write((offset/SD_SECTOR),(s2)/SD_SECTOR,(UINT32)Buff);
-                        ETIMER_Stop(1);
-                    }
+                if (Ini_Writer.Emmc.SkipSame == 1) {
+                    eMMC_Write_Skip(Ini_Writer.UserImage[ImgNo].FileName, Ini_Writer.UserImage[ImgNo].address, Ini_Writer.UserImage[ImgNo].DataSize);
+                } else {
+                    // whole erase groups of the image are erased first, they program faster
+                    fmiSD_EraseGroups(Ini_Writer.UserImage[ImgNo].address/SD_SECTOR, Ini_Writer.UserImage[ImgNo].DataSize/SD_SECTOR);
+                    eMMC_Write_File(Ini_Writer.UserImage[ImgNo].address, Ini_Writer.UserImage[ImgNo].DataSize, 0);
                 }
+                fmiSD_Flush();
                 printf("Write [%s] to eMMC ... done\n",Ini_Writer.UserImage[ImgNo].FileName);
                 f_close(&file2);
             }
@@ -2035,12 +2771,16 @@ _retry_3:
             printf("Write Environment variable to eMMC offset [%x] ... start\n", Ini_Writer.Env.address);
             ETimer1_cnt = 0;
             ETIMER_Start(1);
-            fmiSD_Write((Ini_Writer.Env.address/SD_SECTOR),(0x10000/SD_SECTOR),(UINT32)pENV);
+            fmiSD_WriteReliable((Ini_Writer.Env.address/SD_SECTOR),(0x10000/SD_SECTOR),(UINT32)pENV);
             ETIMER_Stop(1);
             printf("Write Environment variable to eMMC ... done\n");
         }
+        FlushMMCInfo();
+        fmiSD_Flush();
     }
 
+    WaitReadyReport();
+
     while(1) {
         WDT_RSTCNT;
     }
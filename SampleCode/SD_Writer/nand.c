@@ -58,21 +58,26 @@ extern void SetTimer(unsigned int count);
 extern void DelayMicrosecond(unsigned int count);
 extern UINT32 g_uIsUserConfig;
 
-INT fmiSMCheckRB()
+static INT fmiSMIsReady(VOID)
 {
-    SetTimer(3000);
-    while(1) {
-        if((inpw(REG_NANDINTSTS) & 0x400)) { /* RB0_IF */
-            //while(! (inpw(REG_NANDINTSTS) & 0x40000) );
-            outpw(REG_NANDINTSTS, 0x400);
-            return 1;
-        }
-
-        if (inpw(REG_ETMR0_ISR) & 0x1) {
-            outpw(REG_ETMR0_ISR, 0x1);
-            return 0;
-        }
+    if (inpw(REG_NANDINTSTS) & 0x400) { /* RB0_IF */
+        outpw(REG_NANDINTSTS, 0x400);
+        return 1;
     }
+    return 0;
+}
+
+/* return 1 for ready, 0 for timeout */
+INT fmiSMWaitRB(UINT32 op)
+{
+    if (WaitReady(op, fmiSMIsReady) != Successful)
+        return 0;
+    return 1;
+}
+
+INT fmiSMCheckRB()
+{
+    return fmiSMWaitRB(WAIT_NAND_READ);
 }
 
 // SM functions
@@ -82,7 +87,7 @@ INT fmiSM_Reset(void)
     outpw(REG_NANDCMD, 0xff);
     /* delay for NAND flash tWB time */
     DelayMicrosecond(100);
-    if (!fmiSMCheckRB()) {
+    if (!fmiSMWaitRB(WAIT_NAND_RESET)) {
         return Fail;
     }
     return Successful;
@@ -146,10 +151,15 @@ UINT32 fmiSM_ReadOnfi(FMI_SM_INFO_T *pSM)
         /* read parameter */
         outpw(REG_NANDCMD, 0xec);
         outpw(REG_NANDADDR, 0x80000000);
-        fmiSMCheckRB();
+        fmiSMWaitRB(WAIT_NAND_READ);
         for (i=0; i<256; i++)
             tempID[i] = inpb(REG_NANDDATA);
         if (onfi_crc16(0x4F4E, (UINT8 *)tempID, 254) == (tempID[254]|(tempID[255]<<8))) {
+            pSM->bIsCacheProgram = (tempID[8] & 0x01) ? TRUE : FALSE;  // optional commands: page cache program
+            if (tempID[6] & 0x08)   // features: multi-plane program and erase
+                pSM->uPlaneNum = 1 << (tempID[110] & 0x0F);
+            pSM->bIsSetFeature = (tempID[8] & 0x04) ? TRUE : FALSE;
+            pSM->uTimingModes = tempID[129]|(tempID[130]<<8);
             pSM->uPageSize = tempID[80]|(tempID[81]<<8)|(tempID[82]<<16)|(tempID[83]<<24);
             pSM->uSpareSize = tempID[84]|(tempID[85]<<8);
             pSM->uPagePerBlock = tempID[92]|(tempID[93]<<8)|(tempID[94]<<16)|(tempID[95]<<24);
@@ -166,7 +176,7 @@ UINT32 fmiSM_ReadOnfi(FMI_SM_INFO_T *pSM)
                 /* read parameter */
                 outpw(REG_NANDCMD, 0xec);
                 outpw(REG_NANDADDR, 0x80000000);
-                fmiSMCheckRB();
+                fmiSMWaitRB(WAIT_NAND_READ);
                 outpw(REG_NANDCMD, 0x05);
                 outpw(REG_NANDADDR, parampages & 0xFF);
                 outpw(REG_NANDADDR, ((parampages >> 8) & 0xFF) | 0x80000000); // PA8 - PA15
@@ -591,7 +601,7 @@ INT fmiSM_ReadID(FMI_SM_INFO_T *pSM)
  *  INPUT: ucColAddr = 0 means prepare data from begin of page;
  *                   = <page size> means prepare RA data from begin of spare area.
  *---------------------------------------------------------------------------*/
-INT fmiSM2BufferM_large_page(UINT32 uPage, UINT32 ucColAddr)
+static VOID fmiSM_ReadPage_Issue(UINT32 uPage, UINT32 ucColAddr)
 {
     // clear R/B flag
     while(!(inpw(REG_NANDINTSTS) & 0x40000));
@@ -609,8 +619,12 @@ INT fmiSM2BufferM_large_page(UINT32 uPage, UINT32 ucColAddr)
         outpw(REG_NANDADDR, ((uPage >> 16) & 0xff)|0x80000000);   // PA16 - PA18
     }
     outpw(REG_NANDCMD, 0x30);       // read command
+}
 
-    if (!fmiSMCheckRB())
+INT fmiSM2BufferM_large_page(UINT32 uPage, UINT32 ucColAddr)
+{
+    fmiSM_ReadPage_Issue(uPage, ucColAddr);
+    if (!fmiSMWaitRB(WAIT_NAND_READ))
         return FMI_SM_RB_ERR;
     else
         return 0;
@@ -622,138 +636,140 @@ INT fmiSM_Read_RA(UINT32 uPage, UINT32 ucColAddr)
     return fmiSM2BufferM_large_page(uPage, ucColAddr);
 }
 
-INT fmiCheckInvalidBlockExcept0xF0(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
-{
-    int volatile status=0;
-    unsigned int volatile sector;
-    unsigned char volatile data512=0xff, data517=0xff, blockStatus=0xff;
+/*-----------------------------------------------------------------------------
+ * Bad block table, 2 bits per block, built once by fmiSM_ScanBadBlock().
+ * Block marks are read from the spare area only, without fmiSM_Reset() per block.
+ *---------------------------------------------------------------------------*/
+#define NAND_MAX_BLOCK  16384
 
-    if (pSM->bIsMLCNand == TRUE)
-        sector = (BlockNo+1) * pSM->uPagePerBlock - 1;
-    else
-        sector = BlockNo * pSM->uPagePerBlock;
-    MSG_DEBUG("sector %d, BlockNo %d        pSM->uPagePerBlock = %d\n", sector, BlockNo, pSM->uPagePerBlock);
-    status = fmiSM_Read_RA(sector, pSM->uPageSize);
-    if (status < 0) {
-        MSG_DEBUG("ERROR: fmiCheckInvalidBlock(), for block %d, return 0x%x\n", BlockNo, status);
-        return -1;  // storage error
-    }
-    blockStatus = inpw(REG_NANDDATA) & 0xff;
-    MSG_DEBUG("blockStatus= 0x%x\n", blockStatus);
-    if (blockStatus == 0xFF || blockStatus == 0xF0) {
-        fmiSM_Reset();
-        status = fmiSM_Read_RA(sector+1, pSM->uPageSize);
-        if (status < 0) {
-            MSG_DEBUG("ERROR: fmiCheckInvalidBlock(), for block %d, return 0x%x\n", BlockNo, status);
-            return -1;  // storage error
-        }
-        blockStatus = inpw(REG_NANDDATA) & 0xff;
-        MSG_DEBUG("blockStatus= 0x%x\n", blockStatus);
-        if (blockStatus != 0xFF && blockStatus != 0xF0 ) {
-            MSG_DEBUG("ERROR: blockStatus != 0xFF(0x%2x)\n", blockStatus);
-            fmiSM_Reset();
-            return 1;   // invalid block
-        }
-    } else {
-        fmiSM_Reset();
-        return 1;   // invalid block
-    }
+#define BBT_UNKNOWN     0   // not scanned yet
+#define BBT_GOOD        1   // both marks 0xFF
+#define BBT_WORN        2   // marked 0xF0 by fmiMarkBadBlock()
+#define BBT_BAD         3   // factory bad block
 
-    fmiSM_Reset();
-    return 0;
+static UINT8 fmiSM_BBT[NAND_MAX_BLOCK/4];
+
+static INT fmiSM_GetBBT(UINT32 BlockNo)
+{
+    if (BlockNo >= NAND_MAX_BLOCK)
+        return BBT_UNKNOWN;
+    return (fmiSM_BBT[BlockNo/4] >> ((BlockNo%4)*2)) & 0x3;
 }
 
-INT fmiCheckInvalidBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
+static VOID fmiSM_SetBBT(UINT32 BlockNo, INT state)
+{
+    if (BlockNo >= NAND_MAX_BLOCK)
+        return;
+    fmiSM_BBT[BlockNo/4] = (fmiSM_BBT[BlockNo/4] & ~(0x3 << ((BlockNo%4)*2))) | (state << ((BlockNo%4)*2));
+}
+
+/* read the bad block marks of BlockNo, return BBT_xxx or -1 for storage error */
+static INT fmiSM_ReadBlockMark(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
 {
-    int volatile status=0;
-    unsigned int volatile sector;
-    unsigned char volatile data512=0xff, data517=0xff, blockStatus=0xff;
+    UINT32 sector, i;
+    INT state = BBT_GOOD;
+    UINT8 blockStatus;
 
     if (pSM->bIsMLCNand == TRUE)
         sector = (BlockNo+1) * pSM->uPagePerBlock - 1;
     else
         sector = BlockNo * pSM->uPagePerBlock;
 
-    status = fmiSM_Read_RA(sector, pSM->uPageSize);
-    if (status < 0) {
-        MSG_DEBUG("ERROR: fmiCheckInvalidBlock(), for block %d, return 0x%x\n", BlockNo, status);
-        return -1;  // storage error
-    }
-    blockStatus = inpw(REG_NANDDATA) & 0xff;
-    if (blockStatus == 0xFF) {
-        fmiSM_Reset();
-        status = fmiSM_Read_RA(sector+1, pSM->uPageSize);
-        if (status < 0) {
-            MSG_DEBUG("ERROR: fmiCheckInvalidBlock(), for block %d, return 0x%x\n", BlockNo, status);
+    for (i=0; i<2; i++) {
+        if (fmiSM_Read_RA(sector+i, pSM->uPageSize) < 0) {
+            MSG_DEBUG("ERROR: fmiSM_ReadBlockMark(), for block %d\n", BlockNo);
             return -1;  // storage error
         }
         blockStatus = inpw(REG_NANDDATA) & 0xff;
-        if (blockStatus != 0xFF) {
-            fmiSM_Reset();
-            return 1;   // invalid block
-        }
-    } else {
-        fmiSM_Reset();
-        return 1;   // invalid block
+        if (blockStatus == 0xF0)
+            state = BBT_WORN;
+        else if (blockStatus != 0xFF)
+            return BBT_BAD;
     }
+    return state;
+}
+
+static INT fmiSM_BlockState(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
+{
+    INT state;
+
+    fmiSM_EraseSync();
+
+    state = fmiSM_GetBBT(BlockNo);
+    if (state != BBT_UNKNOWN)
+        return state;
 
+    state = fmiSM_ReadBlockMark(pSM, BlockNo);
     fmiSM_Reset();
-    return 0;
+    if (state > 0)
+        fmiSM_SetBBT(BlockNo, state);
+    return state;
 }
 
+/* scan every block once after fmiNandInit(), return the bad block count */
+INT fmiSM_ScanBadBlock(FMI_SM_INFO_T *pSM)
+{
+    UINT32 i;
+    INT state;
+
+    memset(fmiSM_BBT, 0, sizeof(fmiSM_BBT));
+    pSM->uBadBlockCount = 0;
+    for (i=0; (i<pSM->uBlockPerFlash) && (i<NAND_MAX_BLOCK); i++) {
+        state = fmiSM_ReadBlockMark(pSM, i);
+        if (state < 0)
+            continue;   // left unknown, checked again on use
+        fmiSM_SetBBT(i, state);
+        if (state != BBT_GOOD)
+            pSM->uBadBlockCount++;
+    }
+    fmiSM_Reset();
+    return pSM->uBadBlockCount;
+}
 
-INT fmiSM_BlockErase(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+INT fmiCheckInvalidBlockExcept0xF0(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
 {
-    UINT32 page_no;
+    INT state;
 
-#ifndef ERASE_WITH_0XF0
-    if (fmiCheckInvalidBlock(pSM, uBlock) != 1)
-#else
-    if (fmiCheckInvalidBlockExcept0xF0(pSM, uBlock) == 0)
-#endif
-    {
-        page_no = uBlock * pSM->uPagePerBlock;      // get page address
+    state = fmiSM_BlockState(pSM, BlockNo);
+    if (state < 0)
+        return -1;  // storage error
+    return (state == BBT_BAD) ? 1 : 0;
+}
 
-        while(!(inpw(REG_NANDINTSTS) & 0x40000));
-        outpw(REG_NANDINTSTS, 0x400);
+INT fmiCheckInvalidBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
+{
+    INT state;
 
-        if (inpw(REG_NANDINTSTS) & 0x4) {
-            MSG_DEBUG("erase: error sector !!\n");
-            outpw(REG_NANDINTSTS, 0x4);
-        }
-        outpw(REG_NANDCMD, 0x60);     // erase setup command
+    state = fmiSM_BlockState(pSM, BlockNo);
+    if (state < 0)
+        return -1;  // storage error
+    return (state == BBT_GOOD) ? 0 : 1;
+}
 
-        outpw(REG_NANDADDR, (page_no & 0xff));        // PA0 - PA7
-        if (!pSM->bIsMulticycle)
-            outpw(REG_NANDADDR, ((page_no  >> 8) & 0xff)|0x80000000);     // PA8 - PA15
-        else {
-            outpw(REG_NANDADDR, ((page_no  >> 8) & 0xff));        // PA8 - PA15
-            outpw(REG_NANDADDR, ((page_no  >> 16) & 0xff)|0x80000000);        // PA16 - PA17
-        }
 
-        outpw(REG_NANDCMD, 0xd0);     // erase command
-        if (!fmiSMCheckRB())
-            return FMI_SM_RB_ERR;
+/* Blocks erased since they were last programmed. The image loops use it to skip
+   a second erase of blocks wiped by [Erase] or by an erase-ahead. */
+static UINT8 fmiSM_Clean[NAND_MAX_BLOCK/8];
+static INT volatile fmiSM_EraseBlock = -1;    // erase-ahead in flight, -1 for none
 
-        outpw(REG_NANDCMD, 0x70);     // status read command
-        if (inpw(REG_NANDDATA) & 0x01)    // 1:fail; 0:pass
-            return FMI_SM_STATUS_ERR;
-    }
-#ifndef ERASE_WITH_0XF0
-    else if(fmiCheckInvalidBlock(pSM, uBlock) == -1)
-#else
-    else if(fmiCheckInvalidBlockExcept0xF0(pSM, uBlock) == -1)
-#endif
-    {
-        MSG_DEBUG("ERROR: storage error\n");
-        return -1;  // storage error
-    } else {
-        return Fail;
-    }
-    return Successful;
+static VOID fmiSM_SetClean(UINT32 uBlock, BOOL bClean)
+{
+    if (uBlock >= NAND_MAX_BLOCK)
+        return;
+    if (bClean)
+        fmiSM_Clean[uBlock/8] |= (1 << (uBlock%8));
+    else
+        fmiSM_Clean[uBlock/8] &= ~(1 << (uBlock%8));
 }
 
-INT fmiSM_BlockEraseBad(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+BOOL fmiSM_IsClean(UINT32 uBlock)
+{
+    if (uBlock >= NAND_MAX_BLOCK)
+        return FALSE;
+    return (fmiSM_Clean[uBlock/8] & (1 << (uBlock%8))) ? TRUE : FALSE;
+}
+
+static VOID fmiSM_BlockErase_Issue(FMI_SM_INFO_T *pSM, UINT32 uBlock, UINT32 ucCmd)
 {
     UINT32 page_no;
 
@@ -776,22 +792,121 @@ INT fmiSM_BlockEraseBad(FMI_SM_INFO_T *pSM, UINT32 uBlock)
         outpw(REG_NANDADDR, ((page_no  >> 16) & 0xff)|0x80000000);        // PA16 - PA17
     }
 
-    outpw(REG_NANDCMD, 0xd0);     // erase command
-    if (!fmiSMCheckRB())
+    outpw(REG_NANDCMD, ucCmd);    // erase command, 0xd1 queues a multi-plane erase
+}
+
+static INT fmiSM_BlockErase_Status(UINT32 uBlock)
+{
+    if (!fmiSMWaitRB(WAIT_NAND_ERASE))
         return FMI_SM_RB_ERR;
 
     outpw(REG_NANDCMD, 0x70);     // status read command
     if (inpw(REG_NANDDATA) & 0x01)    // 1:fail; 0:pass
         return FMI_SM_STATUS_ERR;
 
+    fmiSM_SetClean(uBlock, TRUE);
+    fmiSM_SetBBT(uBlock, BBT_GOOD);     // erase wipes the bad block mark too
+    return Successful;
+}
+
+INT fmiSM_BlockErase(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    fmiSM_EraseSync();
+#ifndef ERASE_WITH_0XF0
+    if (fmiCheckInvalidBlock(pSM, uBlock) != 1)
+#else
+    if (fmiCheckInvalidBlockExcept0xF0(pSM, uBlock) == 0)
+#endif
+    {
+        fmiSM_BlockErase_Issue(pSM, uBlock, 0xd0);
+        return fmiSM_BlockErase_Status(uBlock);
+    }
+#ifndef ERASE_WITH_0XF0
+    else if(fmiCheckInvalidBlock(pSM, uBlock) == -1)
+#else
+    else if(fmiCheckInvalidBlockExcept0xF0(pSM, uBlock) == -1)
+#endif
+    {
+        MSG_DEBUG("ERROR: storage error\n");
+        return -1;  // storage error
+    } else {
+        return Fail;
+    }
+}
+
+INT fmiSM_BlockEraseBad(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    fmiSM_EraseSync();
+    fmiSM_BlockErase_Issue(pSM, uBlock, 0xd0);
+    return fmiSM_BlockErase_Status(uBlock);
+}
+
+/* uBlock passes the bad block check of fmiSM_BlockErase() and can take data */
+BOOL fmiSM_BlockUsable(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    if (uBlock >= pSM->uBlockPerFlash)
+        return FALSE;
+#ifndef ERASE_WITH_0XF0
+    return (fmiCheckInvalidBlock(pSM, uBlock) == 0) ? TRUE : FALSE;
+#else
+    return (fmiCheckInvalidBlockExcept0xF0(pSM, uBlock) == 0) ? TRUE : FALSE;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Erase-ahead: start erasing uBlock and return without waiting, so the caller
+ * can read the next image data from SD meanwhile. Clean and bad blocks are
+ * skipped. Every NAND access below finishes it first by fmiSM_EraseSync().
+ *---------------------------------------------------------------------------*/
+INT fmiSM_EraseAhead(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    fmiSM_EraseSync();
+    if ((uBlock >= pSM->uBlockPerFlash) || fmiSM_IsClean(uBlock))
+        return Successful;
+    if (!fmiSM_BlockUsable(pSM, uBlock))
+        return Fail;
+
+    fmiSM_BlockErase_Issue(pSM, uBlock, 0xd0);
+    fmiSM_EraseBlock = uBlock;
     return Successful;
 }
 
+/* finish the erase-ahead in flight, a failed block is marked bad */
+INT fmiSM_EraseSync(void)
+{
+    INT status, block;
+
+    if (fmiSM_EraseBlock < 0)
+        return Successful;
+    block = fmiSM_EraseBlock;
+    fmiSM_EraseBlock = -1;
+    status = fmiSM_BlockErase_Status(block);
+    if (status != Successful) {
+        MSG_DEBUG("erase-ahead: block %d fail\n", block);
+        fmiMarkBadBlock(pSM, block);
+    }
+    return status;
+}
+
+/* erase uBlock for programming unless it is still clean */
+INT fmiSM_BlockPrepare(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    fmiSM_EraseSync();
+    if (fmiSM_IsClean(uBlock))
+        return Successful;
+    return fmiSM_BlockErase(pSM, uBlock);
+}
+
 
 INT fmiMarkBadBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
 {
     UINT32 uSector, ucColAddr;
 
+    fmiSM_EraseSync();
+    fmiSM_SetClean(BlockNo, FALSE);
+    if (fmiSM_GetBBT(BlockNo) != BBT_BAD)
+        fmiSM_SetBBT(BlockNo, BBT_WORN);
+
     /* check if MLC NAND */
     if (pSM->bIsMLCNand == TRUE) {
         uSector = (BlockNo+1) * pSM->uPagePerBlock - 1; // write last page
@@ -811,7 +926,7 @@ INT fmiMarkBadBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
         outpw(REG_NANDDATA, 0xf0);  // mark bad block (use 0xf0 instead of 0x00 to differ from Old (Factory) Bad Blcok Mark)
         outpw(REG_NANDCMD, 0x10);
 
-        if (! fmiSMCheckRB())
+        if (! fmiSMWaitRB(WAIT_NAND_PROG))
             return FMI_SM_RB_ERR;
 
         fmiSM_Reset();
@@ -840,7 +955,7 @@ INT fmiMarkBadBlock(FMI_SM_INFO_T *pSM, UINT32 BlockNo)
         outpw(REG_NANDDATA, 0xf0);  // mark bad block (use 0xf0 instead of 0x00 to differ from Old (Factory) Bad Blcok Mark)
         outpw(REG_NANDCMD, 0x10);
 
-        if (! fmiSMCheckRB())
+        if (! fmiSMWaitRB(WAIT_NAND_PROG))
             return FMI_SM_RB_ERR;
 
         fmiSM_Reset();
@@ -866,7 +981,7 @@ _mark_512:
         outpw(REG_NANDDATA, 0xf0);  // 516
         outpw(REG_NANDDATA, 0xf0);  // 517
         outpw(REG_NANDCMD, 0x10);
-        if (! fmiSMCheckRB())
+        if (! fmiSMWaitRB(WAIT_NAND_PROG))
             return FMI_SM_RB_ERR;
 
         fmiSM_Reset();
@@ -874,31 +989,87 @@ _mark_512:
     }
 }
 
-INT fmiSM_Erase(UINT32 uChipSel,UINT32 start, UINT32 len)
+/*-----------------------------------------------------------------------------
+ * Batch erase of len blocks from start. Bad blocks come from the bad block
+ * table, erases are issued back to back without the per block checks of
+ * fmiSM_BlockErase(), a plane pair is erased by one multi-plane erase.
+ * Progress is printed every 1/NAND_ERASE_STEPS of the range.
+ *---------------------------------------------------------------------------*/
+#define NAND_ERASE_STEPS    10
+
+/* uBlock can be erased, -1 for storage error */
+static INT fmiSM_Erasable(UINT32 uBlock)
 {
-    int i, status;
-    int volatile badBlock=0;
+    INT state;
 
-    // erase all chip
-    for (i=0; i<len; i++) {
+    state = fmiSM_BlockState(pSM, uBlock);
+    if (state < 0)
+        return -1;
 #ifndef ERASE_WITH_0XF0
-        if (fmiCheckInvalidBlock(pSM, i+start) != 1)
+    return (state == BBT_GOOD) ? 1 : 0;
 #else
-        if (fmiCheckInvalidBlockExcept0xF0(pSM, i+start) != 1)
+    return (state != BBT_BAD) ? 1 : 0;
 #endif
-        {
-            status = fmiSM_BlockErase(pSM, i+start);
-            if (status < 0) {
-                fmiMarkBadBlock(pSM, i+start);
-                badBlock++;
-            }
-        } else
+}
+
+static INT fmiSM_EraseRange(UINT32 start, UINT32 len)
+{
+    UINT32 i, end, step, next;
+    INT erasable, erasable2, badBlock = 0, storage = 0;
+
+    end = start + len;
+    if (end > pSM->uBlockPerFlash)
+        end = pSM->uBlockPerFlash;
+    step = (len + NAND_ERASE_STEPS - 1) / NAND_ERASE_STEPS;
+    next = start + step;
+
+    fmiSM_EraseSync();
+    for (i=start; i<end; i++) {
+        if (i >= next) {
+            printf("erase %d%%\n", ((i-start)*100) / len);
+            SendAck(((i-start)*100) / len);
+            next += step;
+        }
+
+        erasable = fmiSM_Erasable(i);
+        if (erasable <= 0) {
+            if (erasable < 0)
+                storage = 1;
             badBlock++;
+            continue;
+        }
 
-        /* send status */
-        SendAck(((i+1)*100) /(len));
+        /* plane pair: one multi-plane erase, a failure is sorted out block by block */
+        if ((pSM->uPlaneNum >= 2) && !(i & 1) && (i+1 < end)) {
+            erasable2 = fmiSM_Erasable(i+1);
+            if (erasable2 > 0) {
+                fmiSM_BlockErase_Issue(pSM, i, 0xd1);
+                if (fmiSMWaitRB(WAIT_NAND_CACHE)) {
+                    fmiSM_BlockErase_Issue(pSM, i+1, 0xd0);
+                    if (fmiSM_BlockErase_Status(i+1) == Successful) {
+                        fmiSM_SetClean(i, TRUE);
+                        fmiSM_SetBBT(i, BBT_GOOD);
+                        i++;
+                        continue;
+                    }
+                }
+            }
+        }
+
+        fmiSM_BlockErase_Issue(pSM, i, 0xd0);
+        if (fmiSM_BlockErase_Status(i) != Successful) {
+            fmiMarkBadBlock(pSM, i);
+            badBlock++;
+        }
     }
-    return badBlock;
+    printf("erase 100%%\n");
+    SendAck(100);
+    return storage ? -1 : badBlock;
+}
+
+INT fmiSM_Erase(UINT32 uChipSel,UINT32 start, UINT32 len)
+{
+    return fmiSM_EraseRange(start, len);
 }
 
 INT fmiSM_EraseBad(UINT32 uChipSel,UINT32 start, UINT32 len)
@@ -922,41 +1093,7 @@ INT fmiSM_EraseBad(UINT32 uChipSel,UINT32 start, UINT32 len)
 //-----------------------------------------------------
 INT fmiSM_ChipErase(UINT32 uChipSel)
 {
-    int i, status;
-    int volatile badBlock=0;
-
-    // erase all chip
-    for (i=0; i<=pSM->uBlockPerFlash; i++) {
-#ifndef ERASE_WITH_0XF0
-        if (fmiCheckInvalidBlock(pSM, i) == 0)
-#else
-        if (fmiCheckInvalidBlockExcept0xF0(pSM, i) == 0)
-#endif
-        {
-            status = fmiSM_BlockErase(pSM, i);
-            if (status < 0) {
-                fmiMarkBadBlock(pSM, i);
-                badBlock++;
-            }
-            /* send status */
-            SendAck((i*100) / pSM->uBlockPerFlash);
-        }
-#ifndef ERASE_WITH_0XF0
-        else if (fmiCheckInvalidBlock(pSM, i) == -1)
-#else
-        else if (fmiCheckInvalidBlockExcept0xF0(pSM, i) == -1)
-#endif
-        {
-            badBlock = -1;
-            /* send status */
-            SendAck(0xffff);
-        } else {
-            badBlock++;
-            /* send status */
-            SendAck((i*100) / pSM->uBlockPerFlash);
-        }
-    }
-    return badBlock;
+    return fmiSM_EraseRange(0, pSM->uBlockPerFlash);
 }
 
 INT fmiSM_ChipEraseBad(UINT32 uChipSel)
@@ -983,6 +1120,10 @@ INT fmiSM_ChipEraseBad(UINT32 uChipSel)
 INT fmiSM_Write_large_page_oob(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr,UINT32 oobsize)
 {
     int k;
+
+    fmiSM_EraseSync();
+    fmiSM_SetClean(uSector / pSM->uPagePerBlock, FALSE);
+
     outpw(REG_FMI_DMASA, uSAddr);// set DMA transfer starting address
 
     // write the spare area configuration
@@ -1020,7 +1161,7 @@ INT fmiSM_Write_large_page_oob(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr,U
     outpw(REG_NANDINTSTS, 0x1);  // clear DMA flag
     outpw(REG_NANDCMD, 0x10);   // auto program command
 
-    if (!fmiSMCheckRB())
+    if (!fmiSMWaitRB(WAIT_NAND_PROG))
         return FMI_SM_RB_ERR;
 
     //--- check Region Protect result
@@ -1042,6 +1183,9 @@ INT fmiSM_Write_large_page_oob2(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
 {
     UINT32 readlen,i;
 
+    fmiSM_EraseSync();
+    fmiSM_SetClean(uSector / pSM->uPagePerBlock, FALSE);
+
     readlen=pSM->uPageSize+pSM->uSpareSize;
     outpw(REG_NANDCMD,  0x80);  // serial data input command
     outpw(REG_NANDADDR, 0x00);  // CA0 - CA7
@@ -1057,19 +1201,25 @@ INT fmiSM_Write_large_page_oob2(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
 
     outpw(REG_NANDCMD, 0x10);               // auto program command
 
-    if (!fmiSMCheckRB())
+    if (!fmiSMWaitRB(WAIT_NAND_PROG))
         return FMI_SM_RB_ERR;
 
     return 0;
 }
 
-INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
+/*-----------------------------------------------------------------------------
+ * Program one page, ucCmd is 0x10 (page program), 0x15 (cache program) or
+ * 0x11 (queue the page for a multi-plane program).
+ * After 0x15 R/B is only busy until the cache register is free again, so the
+ * next page's DMA overlaps the array program of this one. The status bit 1
+ * then reports the previous page of the cache sequence.
+ *---------------------------------------------------------------------------*/
+static INT fmiSM_Write_large_page_cmd(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr, UINT32 ucCmd)
 {
-    outpw(REG_FMI_DMASA, uSAddr);   // set DMA transfer starting address
+    fmiSM_EraseSync();
+    fmiSM_SetClean(uSector / pSM->uPagePerBlock, FALSE);
 
-    // set the spare area configuration
-    /* write byte 2050, 2051 as used page */
-    outpw(REG_NANDRA0, 0x0000FFFF);
+    outpw(REG_FMI_DMASA, uSAddr);   // set DMA transfer starting address
 
     // clear R/B flag
     while(!(inpw(REG_NANDINTSTS) & 0x40000));
@@ -1100,9 +1250,9 @@ INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
     }
 
     outpw(REG_NANDINTSTS, 0x1);  // clear DMA flag
-    outpw(REG_NANDCMD, 0x10);   // auto program command
+    outpw(REG_NANDCMD, ucCmd);  // auto program command
 
-    if (!fmiSMCheckRB())
+    if (!fmiSMWaitRB((ucCmd == 0x10) ? WAIT_NAND_PROG : WAIT_NAND_CACHE))
         return FMI_SM_RB_ERR;
 
     //--- check Region Protect result
@@ -1112,8 +1262,11 @@ INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
         return Fail;
     }
 
+    if (ucCmd == 0x11)                  // nothing programmed yet
+        return 0;
+
     outpw(REG_NANDCMD, 0x70);           // status read command
-    if (inpw(REG_NANDDATA) & 0x01) {    // 1:fail; 0:pass
+    if (inpw(REG_NANDDATA) & ((ucCmd == 0x15) ? 0x02 : 0x01)) {    // 1:fail; 0:pass
         MSG_DEBUG("ERROR: fmiSM_Write_large_page(): data error!!\n");
         return FMI_SM_STATE_ERROR;
     }
@@ -1121,6 +1274,236 @@ INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
 }
 
 
+/*-----------------------------------------------------------------------------
+ * Spare area of programmed pages. The BCH parity takes the end of the spare
+ * area, the bytes before it are written from REG_NANDRA0. Every layout keeps
+ * the first word 0x0000FFFF: bad block mark 0xFF and the used page marker
+ * 0x00 in bytes 2, 3, which the boot loader and Linux check to tell a
+ * programmed page from an erased one. The free bytes behind it are:
+ *   NAND_OOB_MARKER: 0xFF
+ *   NAND_OOB_FF:     0xFF, as UBI expects
+ *   NAND_OOB_IMAGE:  from the spare that follows each source page
+ *   NAND_OOB_TAGS:   the source spare from byte 0 (mkyaffs2image tags)
+ * fmiSM_OobFree() is the number of free bytes behind the marker.
+ *---------------------------------------------------------------------------*/
+#define NAND_OOB_MARK_LEN   4
+
+UINT32 fmiSM_OobFree(VOID)
+{
+    UINT32 parity_len, field_len;
+
+    switch (inpw(REG_NANDCTL) & 0x7c0000) {
+    case BCH_T24:
+        field_len  = 1024;
+        parity_len = BCH_PARITY_LEN_T24;
+        break;
+    case BCH_T15:
+        field_len  = 512;
+        parity_len = BCH_PARITY_LEN_T15;
+        break;
+    case BCH_T12:
+        field_len  = 512;
+        parity_len = BCH_PARITY_LEN_T12;
+        break;
+    default:
+        field_len  = 512;
+        parity_len = BCH_PARITY_LEN_T8;
+        break;
+    }
+    return pSM->uSpareSize - parity_len * (pSM->uPageSize / field_len) - NAND_OOB_MARK_LEN;
+}
+
+/* bytes per page in the source buffer */
+UINT32 fmiSM_PageStride(UINT32 uOob)
+{
+    if ((uOob == NAND_OOB_IMAGE) || (uOob == NAND_OOB_TAGS))
+        return pSM->uPageSize + pSM->uSpareSize;
+    return pSM->uPageSize;
+}
+
+static VOID fmiSM_SetRA(UINT32 uOob, UINT32 uOobAddr)
+{
+    UINT8 *src = (UINT8 *)uOobAddr;
+    UINT32 k, b, free, word, val;
+
+    if (uOob == NAND_OOB_MARKER) {
+        /* write byte 2050, 2051 as used page */
+        outpw(REG_NANDRA0, 0x0000FFFF);
+        return;
+    }
+
+    /* bad block mark and used page marker */
+    outpw(REG_NANDRA0, 0x0000FFFF);
+    free = fmiSM_OobFree() + NAND_OOB_MARK_LEN;
+    for (k=NAND_OOB_MARK_LEN; k<free; k+=4) {
+        word = 0;
+        for (b=0; b<4; b++) {
+            if ((k+b >= free) || (uOob == NAND_OOB_FF))
+                val = 0xFF;
+            else if (uOob == NAND_OOB_IMAGE)
+                val = src[k+b];
+            else
+                val = src[k+b-NAND_OOB_MARK_LEN];
+            word |= val << (b*8);
+        }
+        outpw(REG_NANDRA0+k, word);
+    }
+}
+
+INT fmiSM_Write_large_page(UINT32 uSector, UINT32 ucColAddr, UINT32 uSAddr)
+{
+    fmiSM_SetRA(NAND_OOB_MARKER, 0);
+    return fmiSM_Write_large_page_cmd(uSector, ucColAddr, uSAddr, 0x10);
+}
+
+/*-----------------------------------------------------------------------------
+ * Program uCount pages from uPage, all in one block. Chips with ONFI page cache
+ * program get 0x15 on every page but the last one. uOob selects the spare
+ * area content and the source layout, see fmiSM_SetRA().
+ *---------------------------------------------------------------------------*/
+INT fmiSM_Write_Pages_Oob(UINT32 uPage, UINT32 uCount, UINT32 uSAddr, UINT32 uOob)
+{
+    UINT32 i, stride;
+    INT status;
+
+    stride = fmiSM_PageStride(uOob);
+    for (i=0; i<uCount; i++) {
+        fmiSM_SetRA(uOob, uSAddr + pSM->uPageSize);
+        if (pSM->bIsCacheProgram && (i+1 < uCount))
+            status = fmiSM_Write_large_page_cmd(uPage+i, 0, uSAddr, 0x15);
+        else
+            status = fmiSM_Write_large_page_cmd(uPage+i, 0, uSAddr, 0x10);
+        if (status != 0)
+            return status;
+        SMEccStat.uPageProgram++;
+        uSAddr += stride;
+    }
+
+    /* last page of a cache sequence, bit 1 is the page before it */
+    if (pSM->bIsCacheProgram && (uCount > 1)) {
+        outpw(REG_NANDCMD, 0x70);
+        if (inpw(REG_NANDDATA) & 0x02)
+            return FMI_SM_STATE_ERROR;
+    }
+    return 0;
+}
+
+INT fmiSM_Write_Pages(UINT32 uPage, UINT32 uCount, UINT32 uSAddr)
+{
+    return fmiSM_Write_Pages_Oob(uPage, uCount, uSAddr, NAND_OOB_MARKER);
+}
+
+/* uLen bytes at uAddr (word aligned, multiple of 16) are all 0xFF, the SPI NAND
+   writer uses it to skip blank pages as well */
+BOOL fmiSM_IsBlank(UINT32 uAddr, UINT32 uLen)
+{
+    UINT32 *p = (UINT32 *)uAddr;
+    UINT32 i;
+
+    for (i=0; i<uLen/4; i+=4) {
+        if ((p[i] & p[i+1] & p[i+2] & p[i+3]) != 0xFFFFFFFF)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* the source page and its spare, if the layout has one, are all 0xFF */
+static BOOL fmiSM_SrcBlank(UINT32 uSAddr, UINT32 uOob)
+{
+    if (!fmiSM_IsBlank(uSAddr, pSM->uPageSize))
+        return FALSE;
+    if (fmiSM_PageStride(uOob) == pSM->uPageSize)
+        return TRUE;
+    return fmiSM_IsBlank(uSAddr + pSM->uPageSize, pSM->uSpareSize & ~0xF);
+}
+
+/*-----------------------------------------------------------------------------
+ * As fmiSM_Write_Pages_Oob(), but pages of all 0xFF are not programmed: they
+ * read as blank after the erase already (the used page marker stays 0xFF).
+ * The other pages are programmed in runs, each one cache program sequence.
+ *---------------------------------------------------------------------------*/
+INT fmiSM_Write_Pages_Skip(UINT32 uPage, UINT32 uCount, UINT32 uSAddr, UINT32 uOob)
+{
+    UINT32 i, n, stride;
+    INT status;
+
+    stride = fmiSM_PageStride(uOob);
+    i = 0;
+    while (i < uCount) {
+        if (fmiSM_SrcBlank(uSAddr + i*stride, uOob)) {
+            SMEccStat.uPageBlank++;
+            i++;
+            continue;
+        }
+        for (n=i+1; (n < uCount) && !fmiSM_SrcBlank(uSAddr + n*stride, uOob); n++);
+        status = fmiSM_Write_Pages_Oob(uPage+i, n-i, uSAddr + i*stride, uOob);
+        if (status != 0)
+            return status;
+        i = n;
+    }
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * Multi-plane operations on the plane pair uBlock (even) and uBlock+1.
+ * fmiSM_PlanePair() tells whether the pair can be used: the chip reports more
+ * than one plane and both blocks pass the same check as fmiSM_BlockErase().
+ *---------------------------------------------------------------------------*/
+BOOL fmiSM_PlanePair(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    if ((pSM->uPlaneNum < 2) || (uBlock & 1) || (uBlock+1 >= pSM->uBlockPerFlash))
+        return FALSE;
+    return (fmiSM_BlockUsable(pSM, uBlock) && fmiSM_BlockUsable(pSM, uBlock+1)) ? TRUE : FALSE;
+}
+
+/* erase both blocks of the pair unless both are still clean */
+INT fmiSM_BlockPrepare_Plane2(FMI_SM_INFO_T *pSM, UINT32 uBlock)
+{
+    fmiSM_EraseSync();
+    if (fmiSM_IsClean(uBlock) && fmiSM_IsClean(uBlock+1))
+        return Successful;
+
+    fmiSM_BlockErase_Issue(pSM, uBlock, 0xd1);
+    if (!fmiSMWaitRB(WAIT_NAND_CACHE))
+        return FMI_SM_RB_ERR;
+    fmiSM_BlockErase_Issue(pSM, uBlock+1, 0xd0);
+    if (fmiSM_BlockErase_Status(uBlock+1) != Successful)
+        return FMI_SM_STATUS_ERR;   // either block, caller retries them one by one
+
+    fmiSM_SetClean(uBlock, TRUE);
+    fmiSM_SetBBT(uBlock, BBT_GOOD);
+    return Successful;
+}
+
+/* program uCount pages of the pair, page i of both blocks in one multi-plane program,
+   unless it is blank in both */
+INT fmiSM_Write_Pages_Plane2(UINT32 uBlock, UINT32 uCount, UINT32 uSAddr, UINT32 uSAddr2)
+{
+    UINT32 i, page;
+    INT status;
+
+    fmiSM_SetRA(NAND_OOB_MARKER, 0);
+    page = uBlock * pSM->uPagePerBlock;
+    for (i=0; i<uCount; i++) {
+        if (fmiSM_IsBlank(uSAddr, pSM->uPageSize) && fmiSM_IsBlank(uSAddr2, pSM->uPageSize)) {
+            SMEccStat.uPageBlank += 2;
+        } else {
+            status = fmiSM_Write_large_page_cmd(page+i, 0, uSAddr, 0x11);
+            if (status != 0)
+                return status;
+            status = fmiSM_Write_large_page_cmd(page+pSM->uPagePerBlock+i, 0, uSAddr2, 0x10);
+            if (status != 0)
+                return status;
+            SMEccStat.uPageProgram += 2;
+        }
+        uSAddr += pSM->uPageSize;
+        uSAddr2 += pSM->uPageSize;
+    }
+    return 0;
+}
+
+
 static void fmiSM_CorrectData_BCH(UINT8 ucFieidIndex, UINT8 ucErrorCnt, UINT8* pDAddr)
 {
     UINT32 uaData[24], uaAddr[24];
@@ -1263,6 +1646,8 @@ static void fmiSM_CorrectData_BCH(UINT8 ucFieidIndex, UINT8 ucErrorCnt, UINT8* p
     }   // end of for (ii<ucErrorCnt)
 }
 
+static UINT32 fmiSM_EccFlips;   // most bits corrected in one field by the last DMA read
+
 INT fmiSM_Read_move_data_ecc_check(UINT32 uDAddr)
 {
     UINT32 uStatus;
@@ -1293,6 +1678,7 @@ INT fmiSM_Read_move_data_ecc_check(UINT32 uDAddr)
         return -1; // don't work for 512 bytes page
     }
 
+    fmiSM_EccFlips = 0;
     outpw(REG_FMI_DMASA, uDAddr); // set DMA transfer starting address
     outpw(REG_NANDINTSTS, 0x1); // clear DMA flag
     outpw(REG_NANDINTSTS, 0x4); // clear ECC_FIELD flag
@@ -1323,6 +1709,8 @@ INT fmiSM_Read_move_data_ecc_check(UINT32 uDAddr)
                     if ((uStatus & 0x3)==0x01) { // correctable error in field (jj*4+ii)
                         // 2011/8/17 by CJChen1@nuvoton.com, mask uErrorCnt since Fx_ECNT just has 5 valid bits
                         uErrorCnt = (uStatus >> 2) & 0x1F;
+                        if (uErrorCnt > fmiSM_EccFlips)
+                            fmiSM_EccFlips = uErrorCnt;
                         fmiSM_CorrectData_BCH(jj*4+ii, uErrorCnt, (UINT8*)uDAddr);
                         MSG_DEBUG("Warning: Field %d have %d BCH error. Corrected!!\n", jj*4+ii, uErrorCnt);
                         break;
@@ -1354,6 +1742,7 @@ INT fmiSM_Read_large_page(FMI_SM_INFO_T *pSM, UINT32 uPage, UINT32 uDAddr)
 {
     INT result;
 
+    fmiSM_EraseSync();
     result = fmiSM2BufferM_large_page(uPage, 0);
     if (result != 0)
         return result;  // fail for FMI_SM_RB_ERR
@@ -1364,6 +1753,105 @@ INT fmiSM_Read_large_page(FMI_SM_INFO_T *pSM, UINT32 uPage, UINT32 uDAddr)
     return result;
 }
 
+/*-----------------------------------------------------------------------------
+ * Read-back verify. The array read (tR) of the next page runs while the CPU
+ * compares the current one with the source data.
+ *---------------------------------------------------------------------------*/
+#define NAND_PAGE_BUF_MAX       16384
+
+static __align(32) UINT8 fmiSM_PageBuf[2][NAND_PAGE_BUF_MAX];
+
+FMI_SM_ECC_STAT_T SMEccStat;
+
+/* correctable bits per field of the BCH level in use */
+UINT32 fmiSM_ECC_Strength(VOID)
+{
+    switch (inpw(REG_NANDCTL) & 0x7c0000) {
+    case BCH_T24:
+        return 24;
+    case BCH_T15:
+        return 15;
+    case BCH_T12:
+        return 12;
+    default:
+        return 8;
+    }
+}
+
+/* first page from i on whose source is not blank, uCount if none */
+static UINT32 fmiSM_NextUsed(UINT32 uSAddr, UINT32 i, UINT32 uCount, UINT32 uOob)
+{
+    while ((i < uCount) && fmiSM_SrcBlank(uSAddr + i*fmiSM_PageStride(uOob), uOob))
+        i++;
+    return i;
+}
+
+/* Read back uCount pages of uBlock and compare them with the data at uSAddr,
+   laid out as for fmiSM_Write_Pages_Oob(uOob); the spare area is not compared.
+   Pages with a blank source are not read back, fmiSM_Write_Pages_Skip()
+   leaves them erased.
+   *puFlips returns the most bits corrected in one ECC field of the block.
+   Return 0: block matches, FMI_SM_ECC_ERROR: mismatch or uncorrectable page */
+INT fmiSM_Verify_Block(FMI_SM_INFO_T *pSM, UINT32 uBlock, UINT32 uSAddr, UINT32 uCount, UINT32 uOob, UINT32 *puFlips)
+{
+    UINT32 i, next, page, hist, stride;
+    UINT8 *buf;
+    INT status = 0;
+
+    *puFlips = 0;
+    if (pSM->uPageSize > NAND_PAGE_BUF_MAX)
+        return 0;   // no buffer for this page size, not verified
+
+    buf = (UINT8 *)((UINT32)fmiSM_PageBuf[0] | 0x80000000);    /* use non-cache buffer */
+    stride = fmiSM_PageStride(uOob);
+    page = uBlock * pSM->uPagePerBlock;
+    next = fmiSM_NextUsed(uSAddr, 0, uCount, uOob);
+    if (next == uCount)
+        return 0;
+    fmiSM_EraseSync();
+    if (fmiSM2BufferM_large_page(page+next, 0) != 0)
+        return FMI_SM_RB_ERR;
+
+    while (next < uCount) {
+        i = next;
+        SMEccStat.uPageRead++;
+        if (fmiSM_Read_move_data_ecc_check((UINT32)buf) < 0) {
+            MSG_DEBUG("verify: page %d uncorrectable\n", page+i);
+            SMEccStat.uPageUncorrect++;
+            status = FMI_SM_ECC_ERROR;
+        } else {
+            for (hist = 0; (hist < NAND_ECC_HIST-1) && (fmiSM_EccFlips >> hist); hist++);
+            SMEccStat.uPageHist[hist]++;
+            if (fmiSM_EccFlips > *puFlips)
+                *puFlips = fmiSM_EccFlips;
+        }
+
+        next = fmiSM_NextUsed(uSAddr, i+1, uCount, uOob);
+        if (next < uCount)
+            fmiSM_ReadPage_Issue(page+next, 0);
+        if ((status == 0) && (memcmp(buf, (UINT8 *)(uSAddr + i*stride), pSM->uPageSize) != 0)) {
+            MSG_DEBUG("verify: page %d mismatch\n", page+i);
+            SMEccStat.uPageMismatch++;
+            status = FMI_SM_ECC_ERROR;
+        }
+        if ((next < uCount) && !fmiSMWaitRB(WAIT_NAND_READ))
+            return FMI_SM_RB_ERR;
+    }
+    return status;
+}
+
+VOID fmiSM_ECC_Report(VOID)
+{
+    printf("NAND program: %d pages, %d blank pages skipped\n", SMEccStat.uPageProgram, SMEccStat.uPageBlank);
+    if (SMEccStat.uPageRead == 0)
+        return;
+    printf("NAND verify: %d pages read, %d uncorrectable, %d mismatch\n",
+           SMEccStat.uPageRead, SMEccStat.uPageUncorrect, SMEccStat.uPageMismatch);
+    printf("  pages by corrected bits per field: 0:%d 1:%d 2-3:%d 4-7:%d 8-15:%d 16+:%d\n",
+           SMEccStat.uPageHist[0], SMEccStat.uPageHist[1], SMEccStat.uPageHist[2],
+           SMEccStat.uPageHist[3], SMEccStat.uPageHist[4], SMEccStat.uPageHist[5]);
+}
+
 
 BOOL volatile _usbd_bIsFMIInit = FALSE;
 INT fmiHWInit(void)
@@ -1388,6 +1876,118 @@ INT fmiHWInit(void)
     return 0;
 } /* end fmiHWInit */
 
+/*-----------------------------------------------------------------------------
+ * NAND bus timing from the ONFI timing mode.
+ * REG_NANDTMCTL: [22:16] CLE/ALE setup/hold, [15:8] RE/WE high width,
+ * [7:0] RE/WE low width, each in (value+1) HCLK cycles.
+ *---------------------------------------------------------------------------*/
+#define NAND_DEFAULT_TIMING     0x20305
+
+static const UINT8 onfi_tRP[6]  = { 50, 25, 17, 15, 12, 10 };   // tRP/tWP
+static const UINT8 onfi_tREH[6] = { 30, 15, 15, 10, 10,  7 };   // tREH/tWH
+static const UINT8 onfi_tRC[6]  = {100, 45, 35, 30, 25, 20 };   // tRC/tWC
+static const UINT8 onfi_tREA[6] = { 40, 30, 25, 20, 20, 16 };
+static const UINT8 onfi_tCLS[6] = { 50, 25, 15, 10, 10, 10 };   // tCLS/tALS, covers tCLH/tALH
+
+static UINT32 fmiSM_Cycles(UINT32 ns, UINT32 hclk)
+{
+    UINT32 cycles;
+
+    cycles = (ns * hclk + 999) / 1000;
+    return (cycles > 0) ? cycles : 1;
+}
+
+static UINT32 fmiSM_TimingReg(UINT32 mode, UINT32 hclk)
+{
+    UINT32 lo, hi, cale;
+
+    lo = onfi_tREA[mode] + 5;   // 5ns data setup to FMI
+    if (lo < onfi_tRP[mode])
+        lo = onfi_tRP[mode];
+    lo = fmiSM_Cycles(lo, hclk);
+    hi = fmiSM_Cycles(onfi_tREH[mode], hclk);
+    if (lo + hi < fmiSM_Cycles(onfi_tRC[mode], hclk))
+        hi = fmiSM_Cycles(onfi_tRC[mode], hclk) - lo;
+    cale = fmiSM_Cycles(onfi_tCLS[mode], hclk);
+
+    return ((cale-1) << 16) | ((hi-1) << 8) | (lo-1);
+}
+
+static VOID fmiSM_SetTimingMode(UINT32 mode)
+{
+    outpw(REG_NANDINTSTS, 0x400);
+    outpw(REG_NANDCMD, 0xef);           // set features
+    outpw(REG_NANDADDR, 0x80000001);    // feature 01h: timing mode
+    outpw(REG_NANDDATA, mode);
+    outpw(REG_NANDDATA, 0);
+    outpw(REG_NANDDATA, 0);
+    outpw(REG_NANDDATA, 0);
+    fmiSMWaitRB(WAIT_NAND_CACHE);
+}
+
+static BOOL fmiSM_OnfiParamOK(VOID)
+{
+    UINT8 param[256];
+    int i;
+
+    outpw(REG_NANDINTSTS, 0x400);
+    outpw(REG_NANDCMD, 0xec);
+    outpw(REG_NANDADDR, 0x80000000);
+    if (!fmiSMWaitRB(WAIT_NAND_READ))
+        return FALSE;
+    for (i=0; i<256; i++)
+        param[i] = inpb(REG_NANDDATA);
+    return (onfi_crc16(0x4F4E, param, 254) == (param[254]|(param[255]<<8))) ? TRUE : FALSE;
+}
+
+/* Switch to the fastest ONFI timing mode that passes a read-back self test:
+   the parameter page CRC (PIO) and page 0 read by DMA with ECC must match the
+   read done at the default timing. Otherwise the default timing is kept. */
+static VOID fmiSM_TuneTiming(FMI_SM_INFO_T *pSM)
+{
+    UINT32 hclk, mode, reg, i;
+    UINT8 *ref, *buf;
+    INT ref_status;
+
+    if (!gu_fmiSM_IsOnfi || (pSM->uTimingModes <= 1) || (pSM->uPageSize > NAND_PAGE_BUF_MAX))
+        return;
+
+    hclk = sysGetClock(SYS_HCLK);
+    ref = (UINT8 *)((UINT32)fmiSM_PageBuf[0] | 0x80000000);    /* use non-cache buffer */
+    buf = (UINT8 *)((UINT32)fmiSM_PageBuf[1] | 0x80000000);
+    ref_status = fmiSM_Read_large_page(pSM, 0, (UINT32)ref);
+
+    for (mode = 5; mode > 0; mode--) {
+        if (!(pSM->uTimingModes & (1 << mode)))
+            continue;
+        reg = fmiSM_TimingReg(mode, hclk);
+        if (((reg & 0xFF) + ((reg >> 8) & 0xFF)) >= ((NAND_DEFAULT_TIMING & 0xFF) + ((NAND_DEFAULT_TIMING >> 8) & 0xFF)))
+            break;  // not faster than the default timing
+
+        if (pSM->bIsSetFeature)
+            fmiSM_SetTimingMode(mode);
+        outpw(REG_NANDTMCTL, reg);
+
+        for (i=0; i<3; i++) {
+            if (!fmiSM_OnfiParamOK())
+                break;
+            if (fmiSM_Read_large_page(pSM, 0, (UINT32)buf) != ref_status)
+                break;
+            if (memcmp(ref, buf, pSM->uPageSize) != 0)
+                break;
+        }
+        if (i == 3) {
+            printf("NAND timing mode %d, HCLK %dMHz, REG_NANDTMCTL = 0x%x\n", mode, hclk, reg);
+            return;
+        }
+
+        MSG_DEBUG("NAND timing mode %d self test fail\n", mode);
+        outpw(REG_NANDTMCTL, NAND_DEFAULT_TIMING);
+        if (pSM->bIsSetFeature)
+            fmiSM_SetTimingMode(0);
+    }
+}
+
 INT fmiNandInit(void)
 {
     MSG_DEBUG("REG_CLK_HCLKEN = 0x%x\n", inpw(REG_CLK_HCLKEN));
@@ -1403,7 +2003,7 @@ INT fmiNandInit(void)
     outpw(REG_NANDCTL, inpw(REG_NANDCTL) & ~0x02030000 | 0x04000000);
     MSG_DEBUG(">>>>>> REG_NANDCTL = 0x%x\n", inpw(REG_NANDCTL));
 
-    outpw(REG_NANDTMCTL, 0x20305);
+    outpw(REG_NANDTMCTL, NAND_DEFAULT_TIMING);
     outpw(REG_NANDCTL, (inpw(REG_NANDCTL) & ~0x30000) | 0x00000); //512 byte
     outpw(REG_NANDCTL, inpw(REG_NANDCTL) |  0x100); //protect RA 3 byte
     outpw(REG_NANDCTL, inpw(REG_NANDCTL) | 0x10);// Enable auto write redundant data out to NAND flash
@@ -1414,6 +2014,8 @@ INT fmiNandInit(void)
     if (fmiSM_ReadID(pSM) < 0)
         return Fail;
     fmiSM_Initial(pSM);
+    fmiSM_TuneTiming(pSM);
+    fmiSM_ScanBadBlock(pSM);
 
     return 0;
 } /* end fmiHWInit */
@@ -30,6 +30,15 @@ UINT8 *_sd_pSDHCBuffer;
 UINT32 _sd_ReferenceClock;
 
 __align(4096) UINT8 _sd_ucSDHCBuffer[64];
+__align(32) UINT8 _sd_ucExtCSD[512];     // EXT_CSD of the eMMC, read by SD_MMC_ReadExtCSD()
+
+static UINT32 volatile _sd_uCmd23Flag = 0;   // ORed into the CMD23 argument, bit 31: reliable write
+
+#define EMMC_HS26_CLOCK     25000   // kHz, UPLL 300 MHz / 12
+#define EMMC_HS52_CLOCK     50000   // kHz, UPLL 300 MHz / 6
+
+#define EMMC_ERASE_RUN_MS   5000    // spec busy time of one CMD38, well inside the watchdog
+#define EMMC_BUSY_POLL_MS   (EMMC_HS52_CLOCK / 8)   // DAT0 checks per ms at most, 8 clocks each
 
 void SD_CheckRB()
 {
@@ -166,21 +175,20 @@ int SD_SDCmdAndRspDataIn(FMI_SD_INFO_T *pSD, UINT8 ucCmd, UINT32 uArg)
     return Successful;
 }
 
+/* eMMC clock, REG_CLK_DIVCTL3 only: REG_CLK_DIVCTL9 clocks the source SD card of
+   the SDH driver and keeps the rate sdh.c set for it */
 void SD_Set_clock(UINT32 sd_clock_khz)
 {
     UINT32 div;
     if(sd_clock_khz<2000) {
-        outpw(REG_CLK_DIVCTL9, (inpw(REG_CLK_DIVCTL9) & ~0x18) | (0x0 << 3)); 	    // SD clock from XIN [4:3]
         outpw(REG_CLK_DIVCTL3, (inpw(REG_CLK_DIVCTL3) & ~0x18) | (0x0 << 3)); 	    // SD clock from XIN [4:3]
         div=(12000/sd_clock_khz)-1;
     } else {
-        outpw(REG_CLK_DIVCTL9, (inpw(REG_CLK_DIVCTL9) & ~0x18) | (0x3 << 3)); 	    // SD clock from UPLL [4:3]
-        outpw(REG_CLK_DIVCTL3, (inpw(REG_CLK_DIVCTL3) & ~0x18) | (0x3 << 3)); 	    // SD clock from XIN [4:3]
+        outpw(REG_CLK_DIVCTL3, (inpw(REG_CLK_DIVCTL3) & ~0x18) | (0x3 << 3)); 	    // SD clock from UPLL [4:3]
         div=(300000/sd_clock_khz)-1;
     }
-    outpw(REG_CLK_DIVCTL9, (inpw(REG_CLK_DIVCTL9) & ~0xff00) | ((div) << 8)); 	// SD clock divided by CLKDIV9[SD_N] [15:8]
-    outpw(REG_CLK_DIVCTL3, (inpw(REG_CLK_DIVCTL3) & ~0xff00) | ((div) << 8)); 	// SD clock divided by CLKDIV9[SD_N] [15:8]
-    MSG_DEBUG("clock: sd_clock_khz= %d   div = %d, REG_CLK_DIVCTL3=0x%x   REG_CLK_DIVCTL9=0x%x\n", sd_clock_khz, div, inpw(REG_CLK_DIVCTL3), inpw(REG_CLK_DIVCTL9));
+    outpw(REG_CLK_DIVCTL3, (inpw(REG_CLK_DIVCTL3) & ~0xff00) | ((div) << 8)); 	// SD clock divided by CLKDIV3[SD_N] [15:8]
+    MSG_DEBUG("clock: sd_clock_khz= %d   div = %d, REG_CLK_DIVCTL3=0x%x\n", sd_clock_khz, div, inpw(REG_CLK_DIVCTL3));
 
     return;
 }
@@ -353,6 +361,247 @@ int SD_SwitchToHighSpeed(FMI_SD_INFO_T *pSD)
         return Fail;
 }
 
+/*-----------------------------------------------------------------------------
+ * eMMC EXT_CSD access. The FMI eMMC host has a 1-bit and a 4-bit data bus
+ * and single data rate only, so the fastest setting it can reach is 4-bit
+ * with HS_TIMING (HS52, or HS26 on older devices).
+ *---------------------------------------------------------------------------*/
+
+/* CMD8 SEND_EXT_CSD, 512 bytes into _sd_ucExtCSD */
+int SD_MMC_ReadExtCSD(FMI_SD_INFO_T *pSD)
+{
+    int volatile status;
+
+    outpw(REG_FMI_EMMCCTL, (inpw(REG_FMI_EMMCCTL) & ~SD_CSR_BLK_CNT_MASK) | (0x01 << 16));// BLKCNT = 1
+    outpw(REG_EMMC_DMASA, (UINT32)_sd_ucExtCSD);   // set DMA transfer starting address
+    outpw(REG_FMI_EMMCBLEN, 511);
+    status = SD_SDCmdAndRspDataIn(pSD, 8, 0x00);
+    outpw(REG_FMI_EMMCBLEN, SD_BLOCK_SIZE - 1);
+    return status;
+}
+
+/* eMMC write unit in bytes: the erase group if it fits BUFF_SIZE of the
+   writer, else the super page (ACC_SIZE), from the EXT_CSD read at init */
+UINT32 SD_MMC_WriteUnit(UINT32 uMaxSize)
+{
+    UINT32 unit;
+
+    unit = _sd_ucExtCSD[224] * 512 * 1024;      // HC_ERASE_GRP_SIZE
+    if ((unit != 0) && (unit <= uMaxSize) && ((uMaxSize % unit) == 0))
+        return unit;
+    if ((_sd_ucExtCSD[225] & 0xf) != 0)         // ACC_SIZE, super page 512 * 2^(n-1)
+        unit = 512 << ((_sd_ucExtCSD[225] & 0xf) - 1);
+    else
+        unit = 512;
+    return (unit <= uMaxSize) ? unit : 512;
+}
+
+/* SD_CheckRB() for at most uMs, the watchdog is kicked while the device is busy */
+static int SD_CheckRB_Timeout(UINT32 uMs)
+{
+    UINT32 volatile i, polls;
+
+    polls = uMs * EMMC_BUSY_POLL_MS;
+    for (i = 0; i < polls; i++) {
+        outpw(REG_FMI_EMMCCTL, inpw(REG_FMI_EMMCCTL)|SD_CSR_CLK8_OE);
+        while(inpw(REG_FMI_EMMCCTL) & SD_CSR_CLK8_OE);
+        if (inpw(REG_FMI_EMMCINTSTS) & SD_ISR_DATA0)
+            return Successful;
+        if ((i & 0xffff) == 0)
+            outpw(REG_WDT_RSTCNT, 0x5aa5);
+    }
+    return SD_BUSY_TIMEOUT;
+}
+
+/* CMD35/CMD36/CMD38 erase of sectors uStart..uStart+uCount-1, uArg is MMC_xxx_ARG.
+   The range goes out in runs of whole erase groups whose spec timeout
+   (300 ms * ERASE_TIMEOUT_MULT or TRIM_MULT per group) stays below
+   EMMC_ERASE_RUN_MS, the busy wait of each run gives up after twice that. */
+int SD_MMC_Erase(FMI_SD_INFO_T *pSD, UINT32 uStart, UINT32 uCount, UINT32 uArg)
+{
+    int volatile status;
+    UINT32 group, mult, run, count, ms;
+
+    if (uCount == 0)
+        return Successful;
+    if ((status = SD_Select(pSD)) != Successful)
+        return status;
+
+    group = _sd_ucExtCSD[224] * 1024;           // HC_ERASE_GRP_SIZE in sectors
+    if (group == 0)
+        group = 1024;
+    mult = (uArg == MMC_ERASE_ARG) ? _sd_ucExtCSD[223] : _sd_ucExtCSD[232];   // ERASE_TIMEOUT_MULT, TRIM_MULT
+    if (mult == 0)
+        mult = 1;
+    run = EMMC_ERASE_RUN_MS / (300 * mult);
+    run = ((run > 0) ? run : 1) * group;
+
+    while (uCount > 0) {
+        count = (uCount < run) ? uCount : run;
+        if ((status = SD_SDCmdAndRsp(pSD, 35, uStart, 0)) != Successful)
+            return status;
+        if ((status = SD_SDCmdAndRsp(pSD, 36, uStart + count - 1, 0)) != Successful)
+            return status;
+        if ((status = SD_SDCmdAndRsp(pSD, 38, uArg, 0)) != Successful)
+            return status;
+        ms = (count + group - 1) / group * 300 * mult * 2;
+        if ((status = SD_CheckRB_Timeout(ms)) != Successful) {
+            printf("eMMC erase 0x%x: sector %d, %d sectors, busy for more than %d ms\n", uArg, uStart, count, ms);
+            return status;
+        }
+        outpw(REG_WDT_RSTCNT, 0x5aa5);
+        uStart += count;
+        uCount -= count;
+    }
+    MSG_DEBUG("eMMC erase 0x%x done, %d sectors per run\n", uArg, run);
+    return Successful;
+}
+
+/* PARTITION_CONFIG PARTITION_ACCESS: following reads and writes go to uAccess
+   (EMMC_ACCESS_xxx), the boot enable bits are kept */
+int SD_MMC_SelectPartition(FMI_SD_INFO_T *pSD, UINT32 uAccess)
+{
+    int volatile status;
+    UINT32 config;
+
+    config = (_sd_ucExtCSD[179] & ~0x7) | uAccess;
+    if (config == _sd_ucExtCSD[179])
+        return Successful;
+    if ((status = SD_MMC_Switch(pSD, 179, config)) != Successful)
+        return status;
+    _sd_ucExtCSD[179] = config;
+    return Successful;
+}
+
+/* BOOT_BUS_CONDITIONS and PARTITION_CONFIG BOOT_PARTITION_ENABLE, the device
+   boots from uBootPart (1: BOOT0, 2: BOOT1, 7: user area) */
+int SD_MMC_SetBoot(FMI_SD_INFO_T *pSD, UINT32 uBootPart, UINT32 uBusCond)
+{
+    int volatile status;
+    UINT32 config;
+
+    if ((status = SD_MMC_Switch(pSD, 177, uBusCond)) != Successful)
+        return status;
+    config = (_sd_ucExtCSD[179] & ~0x38) | (uBootPart << 3);
+    if ((status = SD_MMC_Switch(pSD, 179, config)) != Successful)
+        return status;
+    _sd_ucExtCSD[177] = uBusCond;
+    _sd_ucExtCSD[179] = config;
+    return Successful;
+}
+
+/* CACHE_CTRL, turn the volatile cache of the eMMC on or off. Fail if the
+   device has no cache (CACHE_SIZE 0). */
+int SD_MMC_CacheCtrl(FMI_SD_INFO_T *pSD, BOOL bEnable)
+{
+    int volatile status;
+
+    if ((pSD->uCardType != SD_TYPE_EMMC) ||
+            ((_sd_ucExtCSD[249] | _sd_ucExtCSD[250] | _sd_ucExtCSD[251] | _sd_ucExtCSD[252]) == 0))
+        return Fail;
+    if ((status = SD_MMC_Switch(pSD, 33, bEnable ? 1 : 0)) != Successful)
+        return status;
+    _sd_ucExtCSD[33] = bEnable ? 1 : 0;
+    return Successful;
+}
+
+/* FLUSH_CACHE, the cached data is in the flash when it returns */
+int SD_MMC_FlushCache(FMI_SD_INFO_T *pSD)
+{
+    if ((pSD->uCardType != SD_TYPE_EMMC) || !(_sd_ucExtCSD[33] & 0x1))
+        return Successful;
+    return SD_MMC_Switch(pSD, 32, 1);
+}
+
+/* Reliable write (CMD23 bit 31), after a power loss the sectors hold either the
+   old or the new data. Without WR_REL_PARAM EN_REL_WR the device takes at most
+   REL_WR_SEC_C sectors per reliable write. */
+int SD_MMC_WriteReliable(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    int volatile status = Successful;
+    UINT32 unit, count;
+
+    if (pSD->uCardType != SD_TYPE_EMMC)
+        return SD_Write_in(pSD, uSector, uBufcnt, uSAddr);
+    unit = (_sd_ucExtCSD[166] & 0x4) ? 0xffff : _sd_ucExtCSD[222];
+    if (unit == 0)
+        unit = 1;
+    _sd_uCmd23Flag = 0x80000000;
+    while (uBufcnt > 0) {
+        count = (uBufcnt < unit) ? uBufcnt : unit;
+        if ((status = SD_Write_in(pSD, uSector, count, uSAddr)) != Successful)
+            break;
+        uSector += count;
+        uSAddr += count * SD_BLOCK_SIZE;
+        uBufcnt -= count;
+    }
+    _sd_uCmd23Flag = 0;
+    return status;
+}
+
+/* CMD6 SWITCH, write value to EXT_CSD byte index and check SWITCH_ERROR */
+int SD_MMC_Switch(FMI_SD_INFO_T *pSD, UINT32 index, UINT32 value)
+{
+    int volatile status;
+
+    if ((status = SD_Select(pSD)) != Successful)
+        return status;
+    if ((status = SD_SDCmdAndRsp(pSD, 6, (3ul << 24) | (index << 16) | (value << 8), 0)) != Successful)
+        return status;
+    SD_CheckRB();
+
+    if ((status = SD_SDCmdAndRsp(pSD, 13, pSD->uRCA, 0)) != Successful)
+        return status;
+    if (inpw(REG_FMI_EMMCRESP1) & 0x80)     // card status bit 7, SWITCH_ERROR
+        return Fail;
+    return Successful;
+}
+
+/* Called in 4-bit mode at the default clock. EXT_CSD is read to check the
+   4-bit bus, the device falls back to 1-bit if it fails. Then HS_TIMING is
+   set and EXT_CSD read again at the high speed clock, the device goes back
+   to the default timing if the data differs. */
+int SD_MMC_SelectTiming(FMI_SD_INFO_T *pSD)
+{
+    int volatile status;
+    UINT8 *ext_csd = (UINT8 *)((UINT32)_sd_ucExtCSD | 0x80000000);
+    UINT32 card_type, clock;
+
+    if (SD_MMC_ReadExtCSD(pSD) != Successful) {
+        MSG_DEBUG("eMMC: 4-bit bus test fail, use 1-bit\n");
+        outpw(REG_FMI_EMMCCTL, inpw(REG_FMI_EMMCCTL) & ~SD_CSR_DBW_4BIT);
+        if ((status = SD_MMC_Switch(pSD, 183, 0)) != Successful)
+            return status;
+        if ((status = SD_MMC_ReadExtCSD(pSD)) != Successful)
+            return status;
+    }
+
+    card_type = ext_csd[196];
+    if (card_type & 0x2)
+        clock = EMMC_HS52_CLOCK;
+    else if (card_type & 0x1)
+        clock = EMMC_HS26_CLOCK;
+    else
+        return Successful;      // default timing only
+
+    if (SD_MMC_Switch(pSD, 185, 1) != Successful) {
+        MSG_DEBUG("eMMC: HS_TIMING switch fail\n");
+        return Successful;
+    }
+    SD_Set_clock(clock);
+
+    /* read EXT_CSD again at the new clock as bus test */
+    if ((SD_MMC_ReadExtCSD(pSD) != Successful) || (ext_csd[185] != 1) || (ext_csd[196] != card_type)) {
+        MSG_DEBUG("eMMC: bus test at %d kHz fail, back to default timing\n", clock);
+        SD_Set_clock(20000);
+        if ((status = SD_MMC_Switch(pSD, 185, 0)) != Successful)
+            return status;
+        return SD_MMC_ReadExtCSD(pSD);
+    }
+    MSG_DEBUG("eMMC: %s-bit bus, %s %d kHz\n", (inpw(REG_FMI_EMMCCTL) & SD_CSR_DBW_4BIT) ? "4" : "1",
+              (clock == EMMC_HS52_CLOCK) ? "HS52" : "HS26", clock);
+    return Successful;
+}
 
 int SD_SelectCardType(FMI_SD_INFO_T *pSD)
 {
@@ -363,6 +612,7 @@ int SD_SelectCardType(FMI_SD_INFO_T *pSD)
         return status;
 
     SD_CheckRB();
+    pSD->bIsSelected = TRUE;    // SD_MMC_Switch() below must not select it again
     MSG_DEBUG("SD_SelectCardType #367\n");
     // if SD card set 4bit
     if (pSD->uCardType == SD_TYPE_SD_HIGH) {
@@ -439,6 +689,16 @@ int SD_SelectCardType(FMI_SD_INFO_T *pSD)
         SD_CheckRB();
 
         outpw(REG_FMI_EMMCCTL, inpw(REG_FMI_EMMCCTL)|SD_CSR_DBW_4BIT);
+
+        if (pSD->uCardType == SD_TYPE_EMMC) {
+            if ((status = SD_MMC_SelectTiming(pSD)) != Successful) {
+                printf("Error SD_SelectCardType  eMMC timing  status =0x%x\n", status);
+                return status;
+            }
+            // ERASE_GROUP_DEF = 1: erase in HC_ERASE_GRP_SIZE units
+            if (SD_MMC_Switch(pSD, 175, 1) == Successful)
+                _sd_ucExtCSD[175] = 1;
+        }
     }
 
     if ((status = SD_SDCmdAndRsp(pSD, 16, SD_BLOCK_SIZE, 0)) != Successful) { // set block length
@@ -448,6 +708,7 @@ int SD_SelectCardType(FMI_SD_INFO_T *pSD)
 
     outpw(REG_FMI_EMMCBLEN, SD_BLOCK_SIZE - 1);           // set the block size
     SD_SDCommand(pSD, 7, 0);
+    pSD->bIsSelected = FALSE;
 
     outpw(REG_FMI_EMMCCTL, inpw(REG_FMI_EMMCCTL)|SD_CSR_CLK8_OE);
     while(inpw(REG_FMI_EMMCCTL) & SD_CSR_CLK8_OE);
@@ -457,6 +718,24 @@ int SD_SelectCardType(FMI_SD_INFO_T *pSD)
     return Successful;
 }
 
+/*-----------------------------------------------------------------------------
+ * SD_Select(), CMD7 select the card unless it is still selected. The card
+ * stays selected after a transfer, consecutive reads and writes skip the
+ * CMD7 select/deselect pair.
+ *---------------------------------------------------------------------------*/
+int SD_Select(FMI_SD_INFO_T *pSD)
+{
+    int volatile status;
+
+    if (pSD->bIsSelected)
+        return Successful;
+    if ((status = SD_SDCmdAndRsp(pSD, 7, pSD->uRCA, 0)) != Successful)
+        return status;
+    SD_CheckRB();
+    pSD->bIsSelected = TRUE;
+    return Successful;
+}
+
 /*-----------------------------------------------------------------------------
  * sdioSD_Read_in_blksize(), To read data with black size "blksize"
  *---------------------------------------------------------------------------*/
@@ -471,9 +750,8 @@ int SD_Read_in_blksize(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT3
         return SD_SELECT_ERROR;
     }
 
-    if ((status = SD_SDCmdAndRsp(pSD, 7, pSD->uRCA, 0)) != Successful)
+    if ((status = SD_Select(pSD)) != Successful)
         return status;
-    SD_CheckRB();
 
     outpw(REG_FMI_EMMCBLEN, blksize - 1);   // the actual byte count is equal to (SDBLEN+1)
     if ((pSD->uCardType == SD_TYPE_SD_HIGH) || (pSD->uCardType == SD_TYPE_EMMC))
@@ -551,7 +829,6 @@ int SD_Read_in_blksize(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT3
     }
 
     SD_CheckRB();
-    SD_SDCommand(pSD, 7, 0);
 
     return Successful;
 }
@@ -567,11 +844,40 @@ int SD_Read_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uDAddr
 /*-----------------------------------------------------------------------------
  * sdioSD_Write_in(), To write data with static black size SD_BLOCK_SIZE
  *---------------------------------------------------------------------------*/
-int SD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+/*
+ * Multiple block write in two halves: SD_Write_Start() sends the command and
+ * the first DMA segment (at most 255 blocks), SD_Write_Poll() starts the next
+ * segment whenever one is done and returns SD_WRITE_BUSY until the whole
+ * transfer is programmed. The CPU is free in between, e.g. to read the next
+ * image data from the SD card on SDH.
+ */
+static struct {
+    BOOL    bIsActive;      // transfer started, not yet finished
+    BOOL    bIsSendCmd;     // CMD25 sent with the first segment
+    BOOL    bIsCountSet;    // CMD23 sent, no CMD12 at the end
+    BOOL    bIsSegment;     // a DMA segment is in flight
+    UINT32  uRemain;        // blocks not yet handed to the DMA
+} _sd_Write;
+
+static void SD_Write_Segment(void)
 {
-    char volatile bIsSendCmd = FALSE;
     unsigned int volatile reg;
-    int volatile i, loop, status;
+    UINT32 count;
+
+    count = (_sd_Write.uRemain > 255) ? 255 : _sd_Write.uRemain;
+    reg = (inpw(REG_FMI_EMMCCTL) & 0xff00c080) | (count << 16);
+    if (!_sd_Write.bIsSendCmd) {
+        outpw(REG_FMI_EMMCCTL, reg|(25<<8)|(SD_CSR_CO_EN | SD_CSR_RI_EN | SD_CSR_DO_EN));
+        _sd_Write.bIsSendCmd = TRUE;
+    } else
+        outpw(REG_FMI_EMMCCTL, reg | SD_CSR_DO_EN);
+    _sd_Write.uRemain -= count;
+    _sd_Write.bIsSegment = TRUE;
+}
+
+int SD_Write_Start(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    int volatile status;
 
     //--- check input parameters
     if (uBufcnt == 0) {
@@ -579,13 +885,23 @@ int SD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAdd
         return SD_SELECT_ERROR;
     }
 
-    if ((status = SD_SDCmdAndRsp(pSD, 7, pSD->uRCA, 0)) != Successful) {
+    if ((status = SD_Select(pSD)) != Successful) {
         printf("#565  Error  status =0x%x\n", status);
         return status;
     }
-    MSG_DEBUG("#568\n");
-    SD_CheckRB();
-    MSG_DEBUG("#570\n");
+
+    _sd_Write.bIsSendCmd = FALSE;
+    _sd_Write.bIsCountSet = FALSE;
+    _sd_Write.bIsSegment = FALSE;
+
+    // eMMC: CMD23 SET_BLOCK_COUNT tells the card the transfer length, no CMD12 at the end
+    if ((pSD->uCardType == SD_TYPE_EMMC) && (uBufcnt <= 0xffff)) {
+        if ((status = SD_SDCmdAndRsp(pSD, 23, uBufcnt | _sd_uCmd23Flag, 0)) != Successful) {
+            printf("#570  Error  CMD23 status =0x%x\n", status);
+            return status;
+        }
+        _sd_Write.bIsCountSet = TRUE;
+    }
 
     // According to SD Spec v2.0, the write CMD block size MUST be 512, and the start address MUST be 512*n.
     outpw(REG_FMI_EMMCBLEN, SD_BLOCK_SIZE - 1);           // set the block size
@@ -596,68 +912,63 @@ int SD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAdd
         outpw(REG_FMI_EMMCCMD, uSector * SD_BLOCK_SIZE);  // set start address for SD CMD
 
     outpw(REG_EMMC_DMASA, uSAddr);
-    loop = uBufcnt / 255;
-    for (i=0; i<loop; i++) {
-        reg = (inpw(REG_FMI_EMMCCTL) & 0xff00c080)|0xff0000;
-        if (!bIsSendCmd) {
-            outpw(REG_FMI_EMMCCTL, reg|(25<<8)|(SD_CSR_CO_EN | SD_CSR_RI_EN | SD_CSR_DO_EN));
-            bIsSendCmd = TRUE;
-        } else
-            outpw(REG_FMI_EMMCCTL, reg | SD_CSR_DO_EN);
+    _sd_Write.uRemain = uBufcnt;
+    _sd_Write.bIsActive = TRUE;
+    SD_Write_Segment();
+    return Successful;
+}
 
-        while(1) {
-            if ((inpw(REG_FMI_EMMCINTSTS) & SD_ISR_BLKD_IF) && (!(inpw(REG_FMI_EMMCCTL) & SD_CSR_DO_EN))) {
-                outpw(REG_FMI_EMMCINTSTS, SD_ISR_BLKD_IF);
-                break;
-            }
-            if (pSD->bIsCardInsert == FALSE)
+int SD_Write_Poll(FMI_SD_INFO_T *pSD)
+{
+    if (!_sd_Write.bIsActive)
+        return Successful;
+
+    if (_sd_Write.bIsSegment) {
+        if (!((inpw(REG_FMI_EMMCINTSTS) & SD_ISR_BLKD_IF) && (!(inpw(REG_FMI_EMMCCTL) & SD_CSR_DO_EN)))) {
+            if (pSD->bIsCardInsert == FALSE) {
+                _sd_Write.bIsActive = FALSE;
                 return SD_NO_SD_CARD;
+            }
+            return SD_WRITE_BUSY;
         }
+        outpw(REG_FMI_EMMCINTSTS, SD_ISR_BLKD_IF);
+        _sd_Write.bIsSegment = FALSE;
 
         if ((inpw(REG_FMI_EMMCINTSTS) & SD_ISR_CRC_IF) != 0) {      // check CRC
+            printf("#599 Error  SD_CRC_ERROR = 0x%x\n", inpw(REG_FMI_EMMCINTSTS));
             outpw(REG_FMI_EMMCINTSTS, SD_ISR_CRC_IF);
-            printf("#599 Error  SD_CRC_ERROR = 0x%x\n", SD_CRC_ERROR);
+            _sd_Write.bIsActive = FALSE;
             return SD_CRC_ERROR;
         }
     }
 
-    loop = uBufcnt % 255;
-    if (loop != 0) {
-        reg = (inpw(REG_FMI_EMMCCTL) & 0xff00c080) | (loop << 16);
-        if (!bIsSendCmd) {
-            outpw(REG_FMI_EMMCCTL, reg|(25<<8)|(SD_CSR_CO_EN | SD_CSR_RI_EN | SD_CSR_DO_EN));
-            bIsSendCmd = TRUE;
-        } else
-            outpw(REG_FMI_EMMCCTL, reg | SD_CSR_DO_EN);
-
-        while(1) {
-            if ((inpw(REG_FMI_EMMCINTSTS) & SD_ISR_BLKD_IF) && (!(inpw(REG_FMI_EMMCCTL) & SD_CSR_DO_EN))) {
-                outpw(REG_FMI_EMMCINTSTS, SD_ISR_BLKD_IF);
-                break;
-            }
-            if (pSD->bIsCardInsert == FALSE)
-                return SD_NO_SD_CARD;
-        }
-
-        if ((inpw(REG_FMI_EMMCINTSTS) & SD_ISR_CRC_IF) != 0) {      // check CRC
-            printf("#623  Error  SD_CRC_ERROR = 0x%x\n", inpw(REG_FMI_EMMCINTSTS));
-            outpw(REG_FMI_EMMCINTSTS, SD_ISR_CRC_IF);
-            return SD_CRC_ERROR;
-        }
+    if (_sd_Write.uRemain > 0) {
+        SD_Write_Segment();
+        return SD_WRITE_BUSY;
     }
+
+    _sd_Write.bIsActive = FALSE;
     outpw(REG_FMI_EMMCINTSTS, SD_ISR_CRC_IF);
-    MSG_DEBUG("#628\n");
-    if (SD_SDCmdAndRsp(pSD, 12, 0, 0)) {    // stop command
-        printf("#630   Error  SD_CRC7_ERROR\n");
-        return SD_CRC7_ERROR;
+    if (!_sd_Write.bIsCountSet) {
+        if (SD_SDCmdAndRsp(pSD, 12, 0, 0)) {    // stop command
+            printf("#630   Error  SD_CRC7_ERROR\n");
+            return SD_CRC7_ERROR;
+        }
     }
     SD_CheckRB();
-    MSG_DEBUG("#634\n");
-    SD_SDCommand(pSD, 7, 0);
-    MSG_DEBUG("#636\n");
     return Successful;
 }
 
+int SD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    int volatile status;
+
+    if ((status = SD_Write_Start(pSD, uSector, uBufcnt, uSAddr)) != Successful)
+        return status;
+    while ((status = SD_Write_Poll(pSD)) == SD_WRITE_BUSY);
+    return status;
+}
+
 
 void SD_Get_SD_info(FMI_SD_INFO_T *pSD, DISK_DATA_T *_info)
 {
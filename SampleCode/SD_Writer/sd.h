@@ -16,6 +16,16 @@
 #define    Successful       0
 #define    Fail             1
 
+//--- CMD38 argument of eMMC
+#define MMC_ERASE_ARG       0x00000000  // erase groups
+#define MMC_TRIM_ARG        0x00000001  // write blocks, read as erased afterwards
+#define MMC_DISCARD_ARG     0x00000003  // write blocks, contents undefined afterwards
+
+//--- PARTITION_CONFIG PARTITION_ACCESS of eMMC
+#define EMMC_ACCESS_USER    0
+#define EMMC_ACCESS_BOOT0   1
+#define EMMC_ACCESS_BOOT1   2
+
 //--- define type of SD card or MMC
 #define SD_TYPE_UNKNOWN     0
 #define SD_TYPE_SD_HIGH     1
@@ -34,6 +44,9 @@
 #define SD_CRC16_ERROR      (SD_ERR_ID|0x17)
 #define SD_CRC_ERROR        (SD_ERR_ID|0x18)
 #define SD_CMD8_ERROR       (SD_ERR_ID|0x19)
+#define SD_WRITE_BUSY       (SD_ERR_ID|0x1A)    // SD_Write_Poll(): transfer still running
+#define SD_NO_BOOT_PART     (SD_ERR_ID|0x1B)    // fmiSD_WriteBoot(): device has no boot partition
+#define SD_BUSY_TIMEOUT     (SD_ERR_ID|0x1C)    // SD_MMC_Erase(): device still busy after the spec timeout
 
 
 /*******************************************/
@@ -126,6 +139,7 @@
 
 // extern global variables
 extern UINT32 _sd_ReferenceClock;
+extern UINT8 _sd_ucExtCSD[512];
 extern UINT8 volatile _sd_SDDataReady;
 
 // function declaration
@@ -136,9 +150,22 @@ int  SD_CmdAndRsp(FMI_SD_INFO_T *pSD, UINT8 ucCmd, UINT32 uArg, int nCount);
 int  SD_CmdAndRsp2(FMI_SD_INFO_T *pSD, UINT8 ucCmd, UINT32 uArg, UINT32 *puR2ptr);
 int  SD_CmdAndRspDataIn(FMI_SD_INFO_T *pSD, UINT8 ucCmd, UINT32 uArg);
 int  SD_SelectCardType(FMI_SD_INFO_T *pSD);
+int  SD_MMC_ReadExtCSD(FMI_SD_INFO_T *pSD);
+int  SD_MMC_Switch(FMI_SD_INFO_T *pSD, UINT32 index, UINT32 value);
+int  SD_MMC_SelectTiming(FMI_SD_INFO_T *pSD);
+UINT32 SD_MMC_WriteUnit(UINT32 uMaxSize);
+int  SD_Select(FMI_SD_INFO_T *pSD);
+int  SD_MMC_Erase(FMI_SD_INFO_T *pSD, UINT32 uStart, UINT32 uCount, UINT32 uArg);
+int  SD_MMC_SelectPartition(FMI_SD_INFO_T *pSD, UINT32 uAccess);
+int  SD_MMC_SetBoot(FMI_SD_INFO_T *pSD, UINT32 uBootPart, UINT32 uBusCond);
+int  SD_MMC_CacheCtrl(FMI_SD_INFO_T *pSD, BOOL bEnable);
+int  SD_MMC_FlushCache(FMI_SD_INFO_T *pSD);
+int  SD_MMC_WriteReliable(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
 void SD_Get_SD_info(FMI_SD_INFO_T *pSD, DISK_DATA_T *_info);
 int  SD_Read_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uDAddr);
 int  SD_Write_in(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+int  SD_Write_Start(FMI_SD_INFO_T *pSD, UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+int  SD_Write_Poll(FMI_SD_INFO_T *pSD);
 void SD_CheckRB(void);
 void SD_SetReferenceClock(UINT32 uClock);
 void SD_Set_clock(UINT32 sd_clock_khz);
@@ -101,6 +101,83 @@ INT fmiSD_Write(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
     return status;
 }
 
+/* Write without waiting: fmiSD_WritePoll() returns SD_WRITE_BUSY until the
+   sectors are programmed, no other eMMC command may be sent meanwhile */
+INT fmiSD_WriteStart(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    return SD_Write_Start(pSD0, uSector, uBufcnt, uSAddr);
+}
+
+INT fmiSD_WritePoll(void)
+{
+    return SD_Write_Poll(pSD0);
+}
+
+/* Small critical regions (image table, env): reliable write, power-fail safe
+   once the command completes */
+INT fmiSD_WriteReliable(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    return SD_MMC_WriteReliable(pSD0, uSector, uBufcnt, uSAddr);
+}
+
+/* Image boundary: write the eMMC volatile cache back to the flash */
+INT fmiSD_Flush(void)
+{
+    return SD_MMC_FlushCache(pSD0);
+}
+
+/* Clear uCount sectors from uSector to zero by TRIM instead of writing them.
+   Fail if the device has no TRIM or erased memory does not read as 0. */
+INT fmiSD_Trim(UINT32 uSector, UINT32 uCount)
+{
+    if ((pSD0->uCardType != SD_TYPE_EMMC) || !(_sd_ucExtCSD[231] & 0x10) || (_sd_ucExtCSD[181] != 0))
+        return Fail;    // SEC_FEATURE_SUPPORT GB_CL_EN, ERASED_MEM_CONT
+    return SD_MMC_Erase(pSD0, uSector, uCount, MMC_TRIM_ARG);
+}
+
+/* Erase the whole erase groups inside uSector..uSector+uCount-1 before they are
+   programmed, a group only partly in the range is left alone */
+INT fmiSD_EraseGroups(UINT32 uSector, UINT32 uCount)
+{
+    UINT32 group, start, end;
+
+    if ((pSD0->uCardType != SD_TYPE_EMMC) || (_sd_ucExtCSD[175] != 1))
+        return Fail;
+    group = _sd_ucExtCSD[224] * 1024;   // HC_ERASE_GRP_SIZE, 512 KB units
+    if (group == 0)
+        return Fail;
+    start = (uSector + group - 1) / group * group;
+    end = (uSector + uCount) / group * group;
+    if (end <= start)
+        return Successful;
+    return SD_MMC_Erase(pSD0, start, end - start, MMC_ERASE_ARG);
+}
+
+/* Write uBufcnt sectors from uSAddr at uSector of BOOT0 and BOOT1, then boot
+   from BOOT0 with a 4-bit SDR boot bus. Reads and writes go back to the user area.
+   SD_NO_BOOT_PART: the device has no boot partition, nothing is written. */
+INT fmiSD_WriteBoot(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
+{
+    UINT32 part;
+    INT status = Fail;
+
+    if ((pSD0->uCardType != SD_TYPE_EMMC) || (_sd_ucExtCSD[226] == 0))
+        return SD_NO_BOOT_PART;
+    if (uSector + uBufcnt > _sd_ucExtCSD[226] * 256)
+        return Fail;    // BOOT_SIZE_MULT, 128 KB units
+    for (part = EMMC_ACCESS_BOOT0; part <= EMMC_ACCESS_BOOT1; part++) {
+        if ((status = SD_MMC_SelectPartition(pSD0, part)) != Successful)
+            break;
+        if ((status = SD_Write_in(pSD0, uSector, uBufcnt, uSAddr)) != Successful)
+            break;
+    }
+    if (SD_MMC_SelectPartition(pSD0, EMMC_ACCESS_USER) != Successful)
+        return Fail;
+    if (status != Successful)
+        return status;
+    return SD_MMC_SetBoot(pSD0, EMMC_ACCESS_BOOT0, 0x01);
+}
+
 //================================================================================
 
 
@@ -109,193 +186,189 @@ INT fmiSD_Write(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr)
  *  eMMC Functions
  *
  ******************************************************************************/
-static BOOL bIsmmcMatch = FALSE;
-static UINT32 *pmmcUpdateImage=0;
-
 extern unsigned char *pImageList;
 extern unsigned char imageList[400];
 
 FW_MMC_IMAGE_T mmcImage;
 FW_MMC_IMAGE_T *pmmcImage;
 
+/*
+ * MMC_INFO_SECTOR: image table (words 0~3 header, 8 words per image from word 4)
+ * and reserve space marker (words 125~127). The sector is read once, updated in
+ * memory during the run and written back by FlushMMCInfo() with reliable write.
+ */
+#define MMC_INFO_BMARK      0xAA554257
+#define MMC_INFO_EMARK      0x63594257
+#define MMC_INFO_MAX_IMAGE  ((SD_SECTOR/4 - 4 - 3) / 8)
+
+__align(32) static UINT32 mmcInfo[SD_SECTOR/4];
+static BOOL bIsmmcInfoLoaded = FALSE, bIsmmcInfoDirty = FALSE;
+
+static UINT32 *LoadMMCInfo(void)
+{
+    UINT32 *ptr = (UINT32 *)((UINT32)mmcInfo | NON_CACHE);
+
+    if (!bIsmmcInfoLoaded) {
+        fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
+        bIsmmcInfoLoaded = TRUE;
+        bIsmmcInfoDirty = FALSE;
+    }
+    return ptr;
+}
+
+/* image count, 0 when the sector holds no image table */
+static UINT32 MMCImageCount(UINT32 *ptr)
+{
+    if ((*(ptr+0) == MMC_INFO_BMARK) && (*(ptr+3) == MMC_INFO_EMARK))
+        return MIN(*(ptr+1), MMC_INFO_MAX_IMAGE);
+    return 0;
+}
+
+/* table entry of imageNo, NULL if it is not in the table */
+UINT32 *FindMMCImage(UINT32 imageNo)
+{
+    UINT32 *ptr = LoadMMCInfo();
+    UINT32 i, count = MMCImageCount(ptr);
+
+    for (i=0, ptr+=4; i<count; i++, ptr+=8) {
+        if ((*ptr & 0xffff) == imageNo)
+            return ptr;
+    }
+    return NULL;
+}
+
+/* MMC_INFO_SECTOR was written behind the table's back (GPT header), read it again */
+void ReloadMMCInfo(void)
+{
+    bIsmmcInfoLoaded = FALSE;
+}
+
+INT FlushMMCInfo(void)
+{
+    INT status;
+
+    if (!bIsmmcInfoDirty)
+        return Successful;
+    status = fmiSD_WriteReliable(MMC_INFO_SECTOR,1,(UINT32)LoadMMCInfo());
+    if (status == Successful)
+        bIsmmcInfoDirty = FALSE;
+    return status;
+}
+
 UINT32 GetMMCReserveSpace()
 {
-    unsigned int volatile *ptr;
-    UINT32 volatile bmark, emark;
-    UCHAR _fmi_ucBuffer[512];
-    unsigned int volatile size=0;
-    ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
-    fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
-    bmark = *(ptr+125);
-    emark = *(ptr+127);
-    MSG_DEBUG("ReserveSpace=>bmark=0x%08x,emark=0x%08x\n",bmark,emark);
-    if ((bmark == 0x11223344) && (emark == 0x44332211))
-        size=*(ptr+126);
-    else
-        size=0;
-    return size;
+    UINT32 *ptr = LoadMMCInfo();
+
+    MSG_DEBUG("ReserveSpace=>bmark=0x%08x,emark=0x%08x\n",*(ptr+125),*(ptr+127));
+    if ((*(ptr+125) == 0x11223344) && (*(ptr+127) == 0x44332211))
+        return *(ptr+126);
+    return 0;
 }
-UINT32 GetMMCImageInfo(unsigned int *image)
+
+void SetMMCReserveSpace(UINT32 size)
 {
-    UINT32 volatile bmark, emark;
-    int volatile i, imageCount=0;
-    unsigned int volatile *ptr;
-    FW_MMC_IMAGE_T *pmmcimage=NULL;
-    UCHAR _fmi_ucBuffer[512];
-
-    ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
-    fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
-    bmark = *(ptr+0);
-    emark = *(ptr+3);
-    MSG_DEBUG("bmark=0x%08x,emark=0x%08x\n",bmark,emark);
-    if ((bmark == 0xAA554257) && (emark == 0x63594257)) {
-        imageCount = *(ptr+1);
-
-        /* pointer to image information */
-        ptr = ptr+4;
-        pmmcimage=(FW_MMC_IMAGE_T *)image;
-        for (i=0; i<imageCount; i++) {
-            /* fill into the image list buffer */
-            pmmcimage->actionFlag=0;
-            pmmcimage->fileLength = 0;
-            pmmcimage->imageNo= *(ptr) & 0xffff;
-            memcpy((CHAR *)pmmcimage->imageName,(char *)(ptr+4),16);
-            pmmcimage->imageType = (*(ptr) >> 16) & 0xffff;
-            pmmcimage->executeAddr = *(ptr+2);
-            pmmcimage->flashOffset = *(ptr+1);
-            pmmcimage->endAddr = *(ptr+3);
-            MSG_DEBUG("\nNo[%d], Flag[%d], name[%s] exeAdr[%d] flashOff[%d] ednAdr[%d]\n\n",
-                      pmmcimage->imageNo,
-                      pmmcimage->imageType,
-                      pmmcimage->imageName,
-                      pmmcimage->executeAddr,
-                      pmmcimage->flashOffset,
-                      pmmcimage->endAddr
-                     );
-            pmmcimage += 1;
-            ptr = ptr+8;
-        }
-    } else
-        imageCount = 0;
+    UINT32 *ptr = LoadMMCInfo();
+
+    *(ptr+125) = 0x11223344;
+    *(ptr+126) = size;
+    *(ptr+127) = 0x44332211;
+    bIsmmcInfoDirty = TRUE;
+}
 
+UINT32 GetMMCImageInfo(unsigned int *image)
+{
+    UINT32 *ptr = LoadMMCInfo();
+    UINT32 i, imageCount = MMCImageCount(ptr);
+    FW_MMC_IMAGE_T *pmmcimage=(FW_MMC_IMAGE_T *)image;
+
+    MSG_DEBUG("bmark=0x%08x,emark=0x%08x\n",*(ptr+0),*(ptr+3));
+    /* pointer to image information */
+    for (i=0, ptr+=4; i<imageCount; i++, ptr+=8) {
+        /* fill into the image list buffer */
+        pmmcimage->actionFlag=0;
+        pmmcimage->fileLength = 0;
+        pmmcimage->imageNo= *(ptr) & 0xffff;
+        memcpy((CHAR *)pmmcimage->imageName,(char *)(ptr+4),16);
+        pmmcimage->imageType = (*(ptr) >> 16) & 0xffff;
+        pmmcimage->executeAddr = *(ptr+2);
+        pmmcimage->flashOffset = *(ptr+1);
+        pmmcimage->endAddr = *(ptr+3);
+        MSG_DEBUG("\nNo[%d], Flag[%d], name[%s] exeAdr[%d] flashOff[%d] ednAdr[%d]\n\n",
+                  pmmcimage->imageNo,
+                  pmmcimage->imageType,
+                  pmmcimage->imageName,
+                  pmmcimage->executeAddr,
+                  pmmcimage->flashOffset,
+                  pmmcimage->endAddr
+                 );
+        pmmcimage += 1;
+    }
     return imageCount;
 }
 
 
 int SetMMCImageInfo(FW_MMC_IMAGE_T *mmcImageInfo)
 {
-    int i, count=0;
-    unsigned char *pbuf;
-    unsigned int *ptr, *pImage;
-    UCHAR _fmi_ucBuffer[512];
-
-    pbuf = (UINT8 *)((UINT32)_fmi_ucBuffer | 0x80000000);
-    ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
-
-
-    fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
-
-    pImage = ptr+4;
-
-    if (((*(ptr+0)) == 0xAA554257) && ((*(ptr+3)) == 0x63594257)) {
-        count = *(ptr+1);
-
-        /* pointer to image information */
-        for (i=0; i<count; i++) {
-            if ((*pImage & 0xffff) == mmcImageInfo->imageNo) {
-                pmmcUpdateImage = pImage;
-                bIsmmcMatch = TRUE;
-                break;
-            }
-            /* pointer to next image */
-            pImage += 8;
-        }
-    } else
-        memset(ptr,0xFF,SD_SECTOR);
-    /* update image information */
-    *(ptr+0) = 0xAA554257;
-    if (!bIsmmcMatch) {
+    UINT32 *ptr = LoadMMCInfo();
+    UINT32 *pmmcUpdateImage, count;
+
+    pmmcUpdateImage = FindMMCImage(mmcImageInfo->imageNo);
+    if (pmmcUpdateImage == NULL) {
+        count = MMCImageCount(ptr);
+        if (count == 0)
+            memset(ptr,0xFF,SD_SECTOR-12);  /* keep the reserve space marker */
+        if (count >= MMC_INFO_MAX_IMAGE)
+            return Fail;
+        *(ptr+0) = MMC_INFO_BMARK;
         *(ptr+1) = count+1;
+        *(ptr+3) = MMC_INFO_EMARK;
         pmmcUpdateImage = (ptr+4) + (count * 8);
     }
-    *(ptr+3) = 0x63594257;
     *(pmmcUpdateImage+0) = (mmcImageInfo->imageNo & 0xffff) | ((mmcImageInfo->imageType & 0xffff) << 16);   // image number / type
     *(pmmcUpdateImage+1) = mmcImageInfo->flashOffset;
     *(pmmcUpdateImage+2) = mmcImageInfo->executeAddr;
     *(pmmcUpdateImage+3) = mmcImageInfo->flashOffset+((mmcImageInfo->fileLength+SD_SECTOR-1)>>9)-1;
     memcpy((char *)(pmmcUpdateImage+4), mmcImageInfo->imageName, 16);   // image name
-
-    fmiSD_Write(MMC_INFO_SECTOR,1,(UINT32)pbuf);
+    bIsmmcInfoDirty = TRUE;
 
     return Successful;
 }
 
 int ChangeMMCImageType(UINT32 imageNo, UINT32 imageType)
 {
-    int i, count;
-    unsigned int *ptr;
-    UCHAR _fmi_ucBuffer[512];
-
-    ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
-
-    fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)ptr);
-
-    if (((*(ptr+0)) == 0xAA554257) && ((*(ptr+3)) == 0x63594257)) {
-        count = *(ptr+1);
-
-        /* pointer to image information */
-        ptr += 4;
-        for (i=0; i<count; i++) {
-            if ((*ptr & 0xffff) == imageNo) {
-                *ptr = ((imageType & 0xffff) << 16) | (imageNo & 0xffff);
-                break;
-            }
-            /* pointer to next image */
-            ptr = ptr+8;
-        }
-    }
-
-    fmiSD_Write(MMC_INFO_SECTOR,1,(UINT32)_fmi_ucBuffer);
+    UINT32 *ptr = FindMMCImage(imageNo);
 
+    if (ptr != NULL) {
+        *ptr = ((imageType & 0xffff) << 16) | (imageNo & 0xffff);
+        bIsmmcInfoDirty = TRUE;
+    }
     return Successful;
 }
 
 int DelMMCImage(UINT32 imageNo)
 {
-    int i=0, count;
-    unsigned int *ptr,*ptr2;
-    //UCHAR _fmi_ucBuffer[512];
-    UCHAR *_fmi_ucBuffer=(UCHAR *)(DOWNLOAD_BASE);
-    ptr2 = ptr = (unsigned int *)((UINT32)_fmi_ucBuffer | 0x80000000);
+    UINT32 *ptr = LoadMMCInfo();
+    UINT32 *pImage, count;
+
     MSG_DEBUG("Del mmc flash Image imageNo=%d ...\n",imageNo);
     SendAck(10);
-    fmiSD_Read(MMC_INFO_SECTOR,1,(UINT32)_fmi_ucBuffer);
     if(imageNo==0xffffffff) { // clear all
-        memset((char *)_fmi_ucBuffer+16,0xff,512-16-12);
+        memset((char *)(ptr+4),0xff,SD_SECTOR-16-12);
         *(ptr+1)=0x0;
-        fmiSD_Write(MMC_INFO_SECTOR,1,(UINT32)_fmi_ucBuffer);
+        bIsmmcInfoDirty = TRUE;
         SendAck(100);
         return Successful;
     }
     SendAck(40);
 
-    if (((*(ptr+0)) == 0xAA554257) && ((*(ptr+3)) == 0x63594257)) {
-        count = *(ptr+1);
-
-        /* pointer to image information */
-        ptr += 4;
-        for (i=0; i<count; i++) {
-            if ((*(ptr) & 0xffff) == imageNo) {
-                *(ptr2+1) = count - 1;  // del one image
-                memcpy((char *)ptr, (char *)(ptr+8), (count-i-1)*32);
-                MSG_DEBUG("Get Del mmc flash Image imageNo=%d ...\n",i);
-                /* send status */
-                fmiSD_Write(MMC_INFO_SECTOR,1,(UINT32)_fmi_ucBuffer);
-                break;
-            }
-            /* pointer to next image */
-            ptr = ptr+8;
-        }
+    pImage = FindMMCImage(imageNo);
+    if (pImage != NULL) {
+        count = MMCImageCount(ptr);
+        *(ptr+1) = count - 1;  // del one image
+        memmove((char *)pImage, (char *)(pImage+8), ((ptr+4+count*8) - (pImage+8))*4);
+        memset((char *)(ptr+4+(count-1)*8), 0xff, 32);
+        MSG_DEBUG("Get Del mmc flash Image imageNo=%d ...\n",imageNo);
+        bIsmmcInfoDirty = TRUE;
     }
 
     SendAck(100);
@@ -18,6 +18,13 @@
 INT  fmiInitSDDevice(void);
 INT  fmiSD_Read(UINT32 uSector, UINT32 uBufcnt, UINT32 uDAddr);
 INT  fmiSD_Write(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+INT  fmiSD_WriteStart(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+INT  fmiSD_WritePoll(void);
+INT  fmiSD_Trim(UINT32 uSector, UINT32 uCount);
+INT  fmiSD_EraseGroups(UINT32 uSector, UINT32 uCount);
+INT  fmiSD_WriteBoot(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+INT  fmiSD_WriteReliable(UINT32 uSector, UINT32 uBufcnt, UINT32 uSAddr);
+INT  fmiSD_Flush(void);
 
 
 void Burn_MMC_RAW(UINT32 len, UINT32 offset,UINT8 *ptr);
@@ -29,6 +36,10 @@ int ChangeMMCImageType(UINT32 imageNo, UINT32 imageType);
 int SetMMCImageInfo(FW_MMC_IMAGE_T *mmcImageInfo);
 UINT32 GetMMCImageInfo(unsigned int *image);
 UINT32 GetMMCReserveSpace(void);
+void SetMMCReserveSpace(UINT32 size);
+UINT32 *FindMMCImage(UINT32 imageNo);
+void ReloadMMCInfo(void);
+INT FlushMMCInfo(void);
 void GetMMCImage(void);
 int DelMMCImage(UINT32 imageNo);
 #endif
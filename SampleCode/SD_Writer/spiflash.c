@@ -34,6 +34,7 @@ int wbSpiWrite(UINT32 addr, UINT32 len, UINT8 *buf);
 int sstSpiWrite(UINT32 addr, UINT32 len, UINT8 *buf);
 int spiEraseAll(void);
 int spiCheckBusy(void);
+int spiWaitBusy(UINT32 op);
 int spiEraseSector(UINT32 addr, UINT32 secCount);
 int spiWrite(UINT32 addr, UINT32 len, UINT8 *buf);
 int spiEnable4ByteAddressMode(void);
@@ -71,16 +72,19 @@ int spiTxLen(int count, int bitLen)
     return Successful;
 }
 
-int spiCheckBusy(void)
+static INT spiIsReady(VOID)
 {
-    uint8_t volatile ReturnValue;
+    return (spiStatusRead() & 1) ? 0 : 1; // check the BUSY bit
+}
 
-    do {
-        ReturnValue = spiStatusRead();
-        ReturnValue = ReturnValue & 1;
-    } while(ReturnValue!=0); // check the BUSY bit
+int spiWaitBusy(UINT32 op)
+{
+    return WaitReady(op, spiIsReady);
+}
 
-    return Successful;
+int spiCheckBusy(void)
+{
+    return spiWaitBusy(WAIT_NOR_MISC);
 }
 
 /*
@@ -432,7 +436,7 @@ int spiEraseSector(UINT32 addr, UINT32 secCount)
         QSPI_SET_SS_HIGH(QSPI_FLASH_PORT);
 
         // check status
-        spiCheckBusy();
+        spiWaitBusy(WAIT_NOR_ERASE);
     }
 
     if(Enable4ByteFlag==1)  spiDisable4ByteAddressMode();
@@ -832,7 +836,7 @@ int wbSpiWrite(UINT32 addr, UINT32 len, UINT8 *buf)
         QSPI_ClearRxFIFO(QSPI_FLASH_PORT);
 
         // check status
-        spiCheckBusy();
+        spiWaitBusy(WAIT_NOR_PROG);
     }
 
     return Successful;
@@ -872,7 +876,7 @@ int sstSpiWrite(UINT32 addr, UINT32 len, UINT8 *buf)
         QSPI_SET_SS_HIGH(QSPI_FLASH_PORT);
 
         // check status
-        spiCheckBusy();
+        spiWaitBusy(WAIT_NOR_PROG);
 
         len--;
     }
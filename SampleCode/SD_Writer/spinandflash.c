@@ -16,10 +16,22 @@
 
 #define MSG_DEBUG		printf  //CWWeng 2018.11.16
 SPINAND_INFO_T SNInfo, *pSN; //CWWeng 2018.11.16 copy from NuWriter firmware parse.c
+SPINAND_ECC_STAT_T SNEccStat;
 
 #define TIMEOUT  1000000   /* unit of timeout is micro second */
 #define QSPI_FLASH_PORT    QSPI0
 
+static uint8_t spiNAND_CurDie = 0;  /* die selected by the last 0xC2 command */
+
+#define SPINAND_LUT_SIZE    20      /* BBM LUT entries per die */
+#define SPINAND_MAX_BLOCK   4096
+
+static uint32_t spiNAND_BBT[SPINAND_MAX_BLOCK/32];  /* 1: block is bad or used as BBM LUT spare */
+static uint32_t spiNAND_Clean[SPINAND_MAX_BLOCK/32]; /* 1: block erased and not programmed since */
+static uint16_t spiNAND_LUT_LBA[SPINAND_MAX_DIE][SPINAND_LUT_SIZE];
+static uint16_t spiNAND_LUT_PBA[SPINAND_MAX_DIE][SPINAND_LUT_SIZE];
+static uint32_t spiNAND_LUT_Spare = 0;  /* spare pool: last blocks of every die */
+
 
 extern void SetTimer(unsigned int count);
 extern void DelayMicrosecond(unsigned int count);
@@ -81,10 +93,47 @@ void spiNAND_Die_Select(uint8_t select_die)
     SPIin(0xC2);        // Software Die Select
     SPIin(select_die);
     spiNAND_CS_HIGH();
+    spiNAND_CurDie = select_die;
 
     return;
 }
 
+/********************
+Function: W25M series (SPISTACK) block to die mapping
+Argument:
+block: block number counted across all dies
+return: die holding the block
+Comment: dies are stacked linearly, die 0 holds the first BlockPerFlash/DieNum blocks
+*********************/
+uint32_t spiNAND_Block_To_Die(uint32_t block)
+{
+    if (pSN->SPINand_DieNum <= 1)
+        return 0;
+
+    return block / (pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum);
+}
+
+/********************
+Function: W25M series (SPISTACK) select the die of a page
+Argument:
+page_address: page address counted across all dies
+return: page address inside the selected die
+*********************/
+uint32_t spiNAND_Die_Page(uint32_t page_address)
+{
+    uint32_t die, die_pages;
+
+    if (pSN->SPINand_DieNum <= 1)
+        return page_address;
+
+    die_pages = (pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum) * pSN->SPINand_PagePerBlock;
+    die = page_address / die_pages;
+    if (die != spiNAND_CurDie)
+        spiNAND_Die_Select(die);
+
+    return page_address % die_pages;
+}
+
 /********************
 Function: Serial NAND BBM Set LUT
 Argument:
@@ -107,6 +156,7 @@ void spiNAND_LUT_Set(uint16_t LBA, uint16_t PBA)
     SPIin((PBA/0x100));
     SPIin((PBA%0x100));
     spiNAND_CS_HIGH();
+    spiNAND_ReadyBusy_Check();
 }
 
 /********************
@@ -135,10 +185,170 @@ void spiNAND_LUT_Read(uint16_t* LBA, uint16_t* PBA)
     return;
 }
 
+/********************
+Function: Software bad block table
+Argument:
+block: block number counted across all dies
+return: 1: block is bad or reserved as BBM LUT spare, 0: block is usable
+*********************/
+uint8_t spiNAND_BBT_IsBad(uint32_t block)
+{
+    if (block >= SPINAND_MAX_BLOCK)
+        return 1;
+    return (spiNAND_BBT[block/32] >> (block%32)) & 0x1;
+}
+
+void spiNAND_BBT_Mark(uint32_t block)
+{
+    if (block < SPINAND_MAX_BLOCK)
+        spiNAND_BBT[block/32] |= (1 << (block%32));
+    spiNAND_Clean_Set(block, 0);
+}
+
+void spiNAND_BBT_Clear(uint32_t block)
+{
+    if (block < SPINAND_MAX_BLOCK)
+        spiNAND_BBT[block/32] &= ~(1 << (block%32));
+}
+
+/********************
+Function: Erased block table, lets the writer skip erasing a block twice
+Argument:
+block: block number counted across all dies
+clean: 1 after a successful erase, 0 once the block is programmed
+return: spiNAND_Is_Clean: 1 for erased and not programmed since
+*********************/
+void spiNAND_Clean_Set(uint32_t block, uint8_t clean)
+{
+    if (block >= SPINAND_MAX_BLOCK)
+        return;
+    if (clean)
+        spiNAND_Clean[block/32] |= (1 << (block%32));
+    else
+        spiNAND_Clean[block/32] &= ~(1 << (block%32));
+}
+
+uint8_t spiNAND_Is_Clean(uint32_t block)
+{
+    if (block >= SPINAND_MAX_BLOCK)
+        return 0;
+    return (spiNAND_Clean[block/32] >> (block%32)) & 0x1;
+}
+
+/********************
+Function: Read the BBM LUT of every die and seed the software bad block table
+Argument:
+spare: number of blocks at the end of every die kept for spiNAND_LUT_Remap()
+return: number of links found, -1 if the device has no BBM LUT
+Comment: Winbond W25N/W25M only. Every linked PBA is taken out of the spare pool.
+*********************/
+int spiNAND_LUT_Init(uint32_t spare)
+{
+    uint32_t die, i, die_blocks;
+    int count = 0;
+
+    if ((pSN->SPINand_ID >> 16) != 0xEF)
+        return -1;
+
+    die_blocks = pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum;
+    spiNAND_LUT_Spare = MIN(spare, die_blocks/2);
+
+    for (die = 0; die < pSN->SPINand_DieNum; die++) {
+        if (pSN->SPINand_DieNum > 1)
+            spiNAND_Die_Select(die);
+        spiNAND_LUT_Read(spiNAND_LUT_LBA[die], spiNAND_LUT_PBA[die]);
+        for (i = 0; i < SPINAND_LUT_SIZE; i++) {
+            if ((spiNAND_LUT_LBA[die][i] & 0x8000) == 0)  // LBA[15]: link enabled
+                continue;
+            spiNAND_BBT_Mark(die*die_blocks + (spiNAND_LUT_PBA[die][i] & 0x3FFF));
+            MSG_DEBUG("BBM LUT die %d: LBA %d -> PBA %d%s\n", die, spiNAND_LUT_LBA[die][i] & 0x3FFF,
+                      spiNAND_LUT_PBA[die][i] & 0x3FFF, (spiNAND_LUT_LBA[die][i] & 0x4000) ? " invalid" : "");
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/********************
+Function: Spare pool of the BBM LUT
+Argument:
+block: block number counted across all dies
+return: 1: block is one of the last spare blocks of its die, kept for spiNAND_LUT_Remap()
+*********************/
+uint8_t spiNAND_LUT_Is_Spare(uint32_t block)
+{
+    uint32_t die_blocks;
+
+    if (spiNAND_LUT_Spare == 0)
+        return 0;
+    die_blocks = pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum;
+    return (block % die_blocks) >= (die_blocks - spiNAND_LUT_Spare);
+}
+
+/********************
+Function: Remap a block to a spare block through the BBM LUT
+Argument:
+block: block number counted across all dies
+return: 0: block is remapped and can be used again, 1: not remapped
+Comment: a block that is already linked is not linked a second time
+*********************/
+int spiNAND_LUT_Remap(uint32_t block)
+{
+    uint32_t die, die_blocks, lba, pba, page, i;
+    int slot = -1;
+
+    if (spiNAND_LUT_Spare == 0)
+        return 1;
+
+    die = spiNAND_Block_To_Die(block);
+    die_blocks = pSN->SPINand_BlockPerFlash / pSN->SPINand_DieNum;
+    lba = block % die_blocks;
+
+    for (i = 0; i < SPINAND_LUT_SIZE; i++) {
+        if (spiNAND_LUT_LBA[die][i] & 0x8000) {
+            if ((spiNAND_LUT_LBA[die][i] & 0x3FFF) == lba)
+                return 1;
+        } else if (slot < 0) {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+        return 1;
+
+    spiNAND_Die_Page(block * pSN->SPINand_PagePerBlock);
+    if (spiNAND_StatusRegister(3) & 0x40)   // LUT-F
+        return 1;
+
+    for (i = 0; i < spiNAND_LUT_Spare; i++) {
+        pba = die_blocks - 1 - i;
+        if (spiNAND_BBT_IsBad(die*die_blocks + pba))
+            continue;
+        spiNAND_BBT_Mark(die*die_blocks + pba);    // out of the pool whatever happens
+        if (spiNAND_bad_block_check((die*die_blocks + pba) * pSN->SPINand_PagePerBlock) == 1)
+            continue;
+        page = pba * pSN->SPINand_PagePerBlock;
+        spiNAND_BlockErase((page>>8)&0xFF, page&0xFF);
+        if (spiNAND_Check_Program_Erase_Fail_Flag() != 0)
+            continue;
+
+        spiNAND_LUT_Set(lba, pba);
+        spiNAND_LUT_LBA[die][slot] = 0x8000 | lba;
+        spiNAND_LUT_PBA[die][slot] = pba;
+        spiNAND_BBT_Clear(block);   // the linked block is good again, keep it in BlockMap
+        MSG_DEBUG("BBM LUT die %d: link LBA %d -> PBA %d\n", die, lba, pba);
+        return 0;
+    }
+
+    return 1;
+}
+
 void spiNANDMarkBadBlock(uint32_t page_address)
 {
     unsigned char data;
 
+    spiNAND_BBT_Mark(page_address / pSN->SPINand_PagePerBlock);
+    page_address = spiNAND_Die_Page(page_address);
     spiNAND_BlockErase(page_address/0x100, page_address%0x100);
 
     /* Set byte 2048 to 0xF0 */
@@ -158,24 +368,106 @@ update: V.1.0.8 // correct the bad block mark address
 *********************/
 uint8_t spiNAND_bad_block_check(uint32_t page_address)
 {
-    uint8_t volatile *read_buf;
+    uint8_t read_buf;
 
-    spiNAND_PageDataRead(page_address/0x100, page_address%0x100); // Read the first page of a block
+    spiNAND_Read_Page_ECC(page_address, NULL, 0); // Read the first page of a block
 
-    spiNAND_Normal_Read(0x8, 0x0, read_buf, 1); // Read bad block mark at 0x800 update at v.1.0.8
-    if(*read_buf != 0xFF) { // update at v.1.0.7
+    spiNAND_Normal_Read(0x8, 0x0, &read_buf, 1); // Read bad block mark at 0x800 update at v.1.0.8
+    if(read_buf != 0xFF) { // update at v.1.0.7
         return 1;
     }
-    spiNAND_PageDataRead((page_address+1)/0x100, (page_address+1)%0x100); // Read the second page of a block
+    spiNAND_Read_Page_ECC(page_address+1, NULL, 0); // Read the second page of a block
 
 
-    spiNAND_Normal_Read(0x8, 0x0, read_buf, 1); // Read bad block mark at 0x800 update at v.1.0.8
-    if(*read_buf != 0xFF) { // update at v.1.0.7
+    spiNAND_Normal_Read(0x8, 0x0, &read_buf, 1); // Read bad block mark at 0x800 update at v.1.0.8
+    if(read_buf != 0xFF) { // update at v.1.0.7
         return 1;
     }
     return 0;
 }
 
+/********************
+Function: Read a page into the data buffer and collect its on-die ECC status
+Argument:
+page_address: page address counted across all dies
+buff, count: copy count bytes of the page to buff, NULL to leave them in the data buffer
+return: ECC-1, ECC-0 status
+*********************/
+uint8_t spiNAND_Read_Page_ECC(uint32_t page_address, uint8_t* buff, uint32_t count)
+{
+    uint32_t page;
+    uint8_t ecc;
+
+    page = spiNAND_Die_Page(page_address);
+    spiNAND_PageDataRead((page>>8)&0xFF, page&0xFF);
+    ecc = spiNAND_Check_Embedded_ECC_Flag();
+
+    SNEccStat.PageRead++;
+    if (ecc == 1)
+        SNEccStat.PageCorrected++;
+    else if (ecc != 0)
+        SNEccStat.PageUncorrect++;
+
+    if (buff != NULL)
+        spiNAND_Normal_Read(0, 0, buff, count);
+
+    return ecc;
+}
+
+/********************
+Function: Read back a programmed block and compare it with the source data
+Argument:
+block: block number counted across all dies
+expect: data the block was programmed with
+buff: one page of work buffer
+page_count: pages to compare
+corrected: returns the number of pages with corrected bit flips
+return:
+0: block matches
+1: mismatch or uncorrectable page
+*********************/
+int spiNAND_Verify_Block(uint32_t block, uint8_t* expect, uint8_t* buff, uint32_t page_count, uint32_t* corrected)
+{
+    uint32_t i, page, hist;
+    uint8_t ecc;
+    int fail = 0;
+
+    *corrected = 0;
+    page = block * pSN->SPINand_PagePerBlock;
+    for (i = 0; i < page_count; i++) {
+        ecc = spiNAND_Read_Page_ECC(page+i, buff, pSN->SPINand_PageSize);
+        if (ecc == 1)
+            (*corrected)++;
+        else if (ecc != 0)
+            fail = 1;
+        if (Program_verify(buff, expect + i*pSN->SPINand_PageSize, pSN->SPINand_PageSize))
+            fail = 1;
+    }
+
+    /* bucket 0, 1, 2-3, 4-7, 8-15, 16+ */
+    for (hist = 0; (hist < SPINAND_ECC_HIST-1) && ((*corrected) >> hist); hist++);
+    SNEccStat.BlockHist[hist]++;
+    if (fail)
+        SNEccStat.BlockUncorrect++;
+
+    return fail;
+}
+
+/********************
+Function: Print the on-die ECC statistics of the burn
+Argument:
+return:
+*********************/
+void spiNAND_ECC_Report()
+{
+    printf("SPI NAND ECC: %d pages read, %d corrected, %d uncorrectable\n",
+           SNEccStat.PageRead, SNEccStat.PageCorrected, SNEccStat.PageUncorrect);
+    printf("  verified blocks by corrected pages: 0:%d 1:%d 2-3:%d 4-7:%d 8-15:%d 16+:%d, fail:%d\n",
+           SNEccStat.BlockHist[0], SNEccStat.BlockHist[1], SNEccStat.BlockHist[2],
+           SNEccStat.BlockHist[3], SNEccStat.BlockHist[4], SNEccStat.BlockHist[5], SNEccStat.BlockUncorrect);
+    printf("SPI NAND program: %d pages, %d blank pages skipped\n", SNEccStat.PageProgram, SNEccStat.PageBlank);
+}
+
 /********************
 Function: Program data verify
 return:
@@ -230,6 +522,20 @@ count: program count
 return: ready busy count
 *********************/
 void spiNAND_Program_Excute(uint8_t addh, uint8_t addl)
+{
+    spiNAND_Program_Excute_NoWait(addh, addl);
+    spiNAND_Wait(WAIT_SPINAND_PROG);
+
+    return;
+}
+
+/********************
+Function: Serial NAND program execute without waiting for ready
+Argument:
+addh, addl: input address
+return:
+*********************/
+void spiNAND_Program_Excute_NoWait(uint8_t addh, uint8_t addl)
 {
     spiNAND_CS_LOW();
     /* Send command : Page program */
@@ -238,11 +544,89 @@ void spiNAND_Program_Excute(uint8_t addh, uint8_t addl)
     SPIin(addh);
     SPIin(addl);
     spiNAND_CS_HIGH();
-    spiNAND_ReadyBusy_Check();
 
     return;
 }
 
+/********************
+Function: Die-interleaved block program for W25M series (SPISTACK)
+Argument:
+job: blocks to program, Page is counted across all dies
+job_count: number of jobs
+Comment: pages are issued round-robin over the jobs. A die is only polled
+         right before its next page is loaded, so while one die is busy
+         with program execute the next page is loaded into the other die.
+         Jobs on the same die (and single-die parts) simply run in turn.
+return: number of jobs with P-FAIL
+*********************/
+int spiNAND_Program_Interleave(SPINAND_PROG_JOB_T *job, uint32_t job_count)
+{
+    int busy[SPINAND_MAX_DIE];  // job programming on each die, -1 for idle
+    uint32_t i, die, page, remain;
+    int fail = 0;
+
+    for (die = 0; die < SPINAND_MAX_DIE; die++)
+        busy[die] = -1;
+    for (i = 0; i < job_count; i++) {
+        job[i].Done = 0;
+        job[i].PFail = 0;
+        spiNAND_Clean_Set(job[i].Page / pSN->SPINand_PagePerBlock, 0);
+    }
+
+    remain = job_count;
+    while (remain) {
+        for (i = 0; i < job_count; i++) {
+            if (job[i].Done == job[i].PageCount)
+                continue;
+
+            if (job[i].SkipBlank && fmiSM_IsBlank((UINT32)(job[i].Buff + job[i].Done * pSN->SPINand_PageSize), pSN->SPINand_PageSize)) {
+                SNEccStat.PageBlank++;  // reads as 0xFF after the erase already
+                if (++job[i].Done == job[i].PageCount)
+                    remain--;
+                continue;
+            }
+
+            die = spiNAND_Block_To_Die(job[i].Page / pSN->SPINand_PagePerBlock);
+            page = spiNAND_Die_Page(job[i].Page + job[i].Done);
+            if (busy[die] >= 0) {
+                spiNAND_Wait(WAIT_SPINAND_PROG);
+                if (spiNAND_Check_Program_Erase_Fail_Flag() != 0)
+                    job[busy[die]].PFail = 1;
+                busy[die] = -1;
+            }
+
+            if (job[i].PFail) {  // block already failed, do not program the rest
+                job[i].Done = job[i].PageCount;
+                remain--;
+                continue;
+            }
+
+            spiNAND_Pageprogram_Pattern(0, 0, job[i].Buff + job[i].Done * pSN->SPINand_PageSize, pSN->SPINand_PageSize);
+            spiNAND_Program_Excute_NoWait((page>>8)&0xFF, page&0xFF);
+            SNEccStat.PageProgram++;
+            busy[die] = i;
+            if (++job[i].Done == job[i].PageCount)
+                remain--;
+        }
+    }
+
+    /* wait for the last page on every die */
+    for (die = 0; die < SPINAND_MAX_DIE; die++) {
+        if (busy[die] < 0)
+            continue;
+        if (pSN->SPINand_DieNum > 1)
+            spiNAND_Die_Select(die);
+        spiNAND_Wait(WAIT_SPINAND_PROG);
+        if (spiNAND_Check_Program_Erase_Fail_Flag() != 0)
+            job[busy[die]].PFail = 1;
+    }
+
+    for (i = 0; i < job_count; i++)
+        fail += job[i].PFail;
+
+    return fail;
+}
+
 /********************
 Function: Do whole Flash protect
 Argument:
@@ -416,6 +800,18 @@ PA_H, PA_L: Page address
 return:
 *********************/
 void spiNAND_BlockErase(uint8_t PA_H, uint8_t PA_L)
+{
+    spiNAND_BlockErase_NoWait(PA_H, PA_L);
+    spiNAND_Wait(WAIT_SPINAND_ERASE);
+}
+
+/********************
+Function: Serial NAND Block erase without waiting for ready
+Argument:
+PA_H, PA_L: Page address
+return:
+*********************/
+void spiNAND_BlockErase_NoWait(uint8_t PA_H, uint8_t PA_L)
 {
     spiNAND_CS_LOW();
     SPIin(0x06);
@@ -428,8 +824,6 @@ void spiNAND_BlockErase(uint8_t PA_H, uint8_t PA_L)
     SPIin(PA_H);
     SPIin(PA_L);
     spiNAND_CS_HIGH();
-
-    spiNAND_ReadyBusy_Check();
 }
 
 /********************
@@ -492,7 +886,7 @@ void spiNAND_PageDataRead(uint8_t PA_H, uint8_t PA_L)
     SPIin(PA_H); // Page address
     SPIin(PA_L); // Page address
     spiNAND_CS_HIGH();
-    spiNAND_ReadyBusy_Check(); // Need to wait for the data transfer.
+    spiNAND_Wait(WAIT_SPINAND_READ); // Need to wait for the data transfer.
     return;
 }
 
@@ -643,49 +1037,46 @@ void spiNAND_Reset()
 }
 
 
+/********************
+Function: SPI NAND status register 3 BUSY bit
+Argument:
+return: 1 for ready, 0 for busy
+*********************/
+static INT spiNAND_IsReady(VOID)
+{
+    uint8_t volatile SR;
+
+    spiNAND_CS_LOW();
+    SPIin(0x0F);
+    SPIin(0xC0);
+    SR = SPIin(0x00);
+    spiNAND_CS_HIGH();
+
+    return (SR & 0x1) ? 0 : 1;
+}
+
+/********************
+Function: SPI NAND wait for ready
+Argument:
+op: WAIT_SPINAND_xxx, selects the deadline and busy time statistics
+return: 0 for ready, 1 for timeout
+*********************/
+int8_t spiNAND_Wait(uint32_t op)
+{
+    if (WaitReady(op, spiNAND_IsReady) != Successful)
+        return 1;
+
+    return 0;
+}
+
 /********************
 Function: SPI NAND Ready busy check
 Argument:
-return:
+return: 0 for ready, 1 for timeout
 *********************/
 int8_t spiNAND_ReadyBusy_Check()
 {
-    uint8_t volatile SR = 0xFF;
-
-    SetTimer(5000);
-    if(pSN->SPINand_ID == 0xEFAA21) { /* winbond */
-    //if(1){
-        while((SR & 0x1) != 0x00) {
-            spiNAND_CS_LOW();
-            SPIin(0x0F);
-            SPIin(0xC0);
-            SR = SPIin(0x00);
-            spiNAND_CS_HIGH();
-            if (inpw(REG_ETMR0_ISR) & 0x1) {
-                outpw(REG_ETMR0_ISR, 0x1);
-                printf("Error winbond spiNAND_ReadyBusy_Check timeout\n");
-                return 1;
-            }
-        }
-    } else { // MXIC
-        while((SR & 0x1) != 0x00) {
-            spiNAND_CS_LOW();
-            SPIin(0x0F);
-            SPIin(0xC0);
-            /* Check the BUSY flag */
-            //while(inpw(REG_QSPI0_STATUS) & 0x1);
-            SR = SPIin(0x00);
-            spiNAND_CS_HIGH();
-
-            if (inpw(REG_ETMR0_ISR) & 0x1) {
-                outpw(REG_ETMR0_ISR, 0x1);
-                printf("Error MXIC spiNAND_ReadyBusy_Check timeout\n");
-                return 1;
-            }
-        }
-    }
-			
-    return 0;
+    return spiNAND_Wait(WAIT_SPINAND_MISC);
 }
 
 /********************
@@ -753,6 +1144,7 @@ BOOL volatile _usbd_bIsSPINANDInit = FALSE;
 int spiNANDInit()
 {
     unsigned int volatile u32ReturnValue;
+    uint32_t die;
 
     /* select QSPI0 function pins */
     outpw(REG_CLK_PCLKEN1, (inpw(REG_CLK_PCLKEN1) | 0x10)); /* enable QSPI0 clock */
@@ -781,10 +1173,14 @@ int spiNANDInit()
         if (spiNAND_ReadINFO(pSN)< 0)
             return Fail;
 
-        // un-protect
-        u32ReturnValue = spiNAND_StatusRegister(1);
-        u32ReturnValue &= 0x83;
-        spiNAND_StatusRegister_Write_SR1(u32ReturnValue);
+        // un-protect, every die of a stacked part has its own status registers
+        for (die = pSN->SPINand_DieNum; die > 0; die--) {
+            if (pSN->SPINand_DieNum > 1)
+                spiNAND_Die_Select(die-1);
+            u32ReturnValue = spiNAND_StatusRegister(1);
+            u32ReturnValue &= 0x83;
+            spiNAND_StatusRegister_Write_SR1(u32ReturnValue);
+        }
 
         _usbd_bIsSPINANDInit = TRUE;
     }
@@ -795,6 +1191,7 @@ int spiNANDInit()
 INT spiNAND_ReadINFO(SPINAND_INFO_T *pSN)
 {
     pSN->SPINand_ID=spiNAND_ReadID();
+    pSN->SPINand_DieNum = 1;
 
     if(info.SPINand_uIsUserConfig == 1) {
         pSN->SPINand_ID = pSN->SPINand_ID;
@@ -834,6 +1231,32 @@ INT spiNAND_ReadINFO(SPINAND_INFO_T *pSN)
             info.SPINand_BlockPerFlash = 0x400;// 1024 blocks per 1G NAND
             info.SPINand_PagePerBlock = 64; // 64 pages per block
 
+        } else if(pSN->SPINand_ID == 0xEFAB21) { /* winbond W25M02GV, two stacked W25N01GV dies */
+            pSN->SPINand_ID = 0xEFAB21;
+            pSN->SPINand_PageSize=0x800; // 2048 bytes per page
+            pSN->SPINand_SpareArea=0x40; // 64 bytes per page spare area
+            pSN->SPINand_QuadReadCmd = 0x6b;
+            pSN->SPINand_ReadStatusCmd = 0xff;
+            pSN->SPINand_WriteStatusCmd =0xff;
+            pSN->SPINand_StatusValue = 0xff;
+            pSN->SPINand_dummybyte = 0x1;
+            pSN->SPINand_BlockPerFlash = 0x800;// 1024 blocks per die, 2 dies
+            pSN->SPINand_PagePerBlock = 64; // 64 pages per block
+            pSN->SPINand_DieNum = 2;
+
+            info.SPINand_ID = 0xEFAB21;
+            info.SPINand_PageSize=0x800; // 2048 bytes per page
+            info.SPINand_SpareArea=0x40; // 64 bytes per page spare area
+            info.SPINand_QuadReadCmd = 0x6b;
+            info.SPINand_ReadStatusCmd = 0xff;
+            info.SPINand_WriteStatusCmd =0xff;
+            info.SPINand_StatusValue = 0xff;
+            info.SPINand_dummybyte = 0x1;
+            info.SPINand_BlockPerFlash = 0x800;// 1024 blocks per die, 2 dies
+            info.SPINand_PagePerBlock = 64; // 64 pages per block
+
+            spiNAND_Die_Select(0);
+
         } else if(pSN->SPINand_ID == 0xC212) { /* mxic */
             pSN->SPINand_ID = 0xC212;
             pSN->SPINand_PageSize=0x800; // 2048 bytes per page
@@ -34,14 +34,46 @@ typedef struct spinand_info
     UINT8    SPINand_dummybyte;
     UINT32   SPINand_BlockPerFlash;
     UINT32   SPINand_PagePerBlock;
+    UINT32   SPINand_DieNum;        /* W25M (SPISTACK) stacked dies, 1 for single die */
     //UINT32   SPINand_BadBlockNum;
     //UINT32   SPINand_RecBadBlock[16];
 } SPINAND_INFO_T;
 
+#define SPINAND_MAX_DIE     2
+
+/* one block to be programmed by spiNAND_Program_Interleave() */
+typedef struct spinand_prog_job
+{
+    uint32_t  Page;         /* first page, counted across all dies */
+    uint8_t   *Buff;        /* PageCount pages of data */
+    uint32_t  PageCount;
+    uint32_t  Done;         /* pages issued so far */
+    uint8_t   PFail;        /* 1: P-FAIL reported on this block */
+    uint8_t   SkipBlank;    /* 1: pages of all 0xFF are left erased */
+} SPINAND_PROG_JOB_T;
+
+#define SPINAND_ECC_HIST    6   /* corrected pages per block: 0, 1, 2-3, 4-7, 8-15, 16+ */
+
+/* on-die ECC status collected on every read */
+typedef struct spinand_ecc_stat
+{
+    uint32_t  PageRead;
+    uint32_t  PageCorrected;    /* ECC-1,0 = 01: bit flips corrected */
+    uint32_t  PageUncorrect;    /* ECC-1,0 = 1x: uncorrectable */
+    uint32_t  BlockHist[SPINAND_ECC_HIST];
+    uint32_t  BlockUncorrect;   /* verified blocks with an uncorrectable page */
+    uint32_t  PageProgram;      /* pages programmed */
+    uint32_t  PageBlank;        /* pages of all 0xFF skipped */
+} SPINAND_ECC_STAT_T;
+
+extern SPINAND_ECC_STAT_T SNEccStat;
+
 /* program function */
 uint8_t Program_verify(uint8_t* buff1, uint8_t* buff2, uint32_t count);
 void spiNAND_Pageprogram_Pattern(uint8_t addh, uint8_t addl, uint8_t* program_buffer, uint32_t count);
 void spiNAND_Program_Excute(uint8_t addh, uint8_t addl);
+void spiNAND_Program_Excute_NoWait(uint8_t addh, uint8_t addl);
+int spiNAND_Program_Interleave(SPINAND_PROG_JOB_T *job, uint32_t job_count);
 
 /* status check */
 uint8_t spiNAND_Check_Embedded_ECC(void);
@@ -49,12 +81,23 @@ uint8_t spiNAND_Check_Embedded_ECC_Flag(void);
 uint8_t spiNAND_Check_Program_Erase_Fail_Flag(void);
 uint8_t spiNAND_StatusRegister(uint8_t sr_sel);
 int8_t spiNAND_ReadyBusy_Check(void);
+int8_t spiNAND_Wait(uint32_t op);
 uint32_t spiNAND_Read_JEDEC_ID(void);
 uint8_t spiNAND_bad_block_check(uint32_t page_address);
 void spiNAND_LUT_Read(uint16_t* LBA, uint16_t* PBA);
+int spiNAND_LUT_Init(uint32_t spare);
+int spiNAND_LUT_Remap(uint32_t block);
+uint8_t spiNAND_LUT_Is_Spare(uint32_t block);
+uint8_t spiNAND_BBT_IsBad(uint32_t block);
+void spiNAND_BBT_Mark(uint32_t block);
+void spiNAND_BBT_Clear(uint32_t block);
+void spiNAND_Clean_Set(uint32_t block, uint8_t clean);
+uint8_t spiNAND_Is_Clean(uint32_t block);
 
 /* Stack function for W25M series */
 void spiNAND_Die_Select(uint8_t select_die);
+uint32_t spiNAND_Block_To_Die(uint32_t block);
+uint32_t spiNAND_Die_Page(uint32_t page_address);
 
 /* status set */
 void spiNAND_Enable_Embedded_ECC(void);
@@ -71,6 +114,7 @@ void spiNAND_LUT_Set(uint16_t LBA, uint16_t PBA);
 
 /* erase function */
 void spiNAND_BlockErase(uint8_t PA_H, uint8_t PA_L);
+void spiNAND_BlockErase_NoWait(uint8_t PA_H, uint8_t PA_L);
 
 /* read function */
 void spiNAND_PageDataRead(uint8_t PA_H, uint8_t PA_L);
@@ -78,6 +122,9 @@ void spiNAND_Normal_Read(uint8_t addh, uint8_t addl, uint8_t* buff, uint32_t cou
 void spiNAND_Continuous_Normal_Read(uint8_t* buff, uint32_t count);
 void spiNAND_QuadIO_Read(uint8_t addh, uint8_t addl, uint8_t* buff, uint32_t count);
 void spiNAND_QuadOutput_Read(uint8_t addh, uint8_t addl, uint8_t* buff, uint32_t count);
+uint8_t spiNAND_Read_Page_ECC(uint32_t page_address, uint8_t* buff, uint32_t count);
+int spiNAND_Verify_Block(uint32_t block, uint8_t* expect, uint8_t* buff, uint32_t page_count, uint32_t* corrected);
+void spiNAND_ECC_Report(void);
 
 /* Hardware Control */
 void spiNAND_CS_LOW(void);
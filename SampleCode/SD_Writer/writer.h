@@ -50,12 +50,20 @@ typedef struct IBR_boot_struct_t {
     unsigned int  Reserved;
 } IBR_BOOT_STRUCT_T;
 
+/* image types, optional field of a [DataN] line (NAND only) */
+#define IMAGE_DATA      0   // plain data, used page marker in the spare area
+#define IMAGE_RAW       1   // page + spare image, spare bytes from the image
+#define IMAGE_UBI       2   // spare area left 0xFF
+#define IMAGE_YAFFS2    3   // page + spare image from mkyaffs2image, tags placed behind the bad block mark
+
 typedef struct USER_IMAGE_Info {
     char 					FileName[1024];
     int	 					StartBlock;
     int  					address;
     unsigned int	DataSize;
     int						user_choice;
+    unsigned int	ImageType;
+    unsigned int	PartSize;   // NAND/SPI NAND partition bytes, 0: up to the next image
 } INI_USER_IMAGE_T;
 
 typedef struct ERASE_Info {
@@ -84,9 +92,35 @@ typedef struct EMMC_FORMAT_Info {
     unsigned int Partition2Size;  //unit of MB
     unsigned int Partition3Size;  //unit of MB
     unsigned int Partition4Size;  //unit of MB	
+    unsigned int GPT;             // 1: GUID partition table instead of MBR
+    unsigned int PartCount;       // Part= lines, 0: GPT from the four sizes above
+    FW_MMC_PART_T Part[MMC_MAX_PART];
     unsigned int user_choice;
 } EMMC_FORMAT_Info;
 
+typedef struct SPINAND_OPT_Info {
+    unsigned int BBM_LUT;       // 1: remap bad blocks through the on-chip BBM LUT (Winbond)
+    unsigned int LUTSpare;      // spare blocks kept at the end of every die for the LUT, images skip them
+    unsigned int Verify;        // 1: read back every programmed block and collect ECC status
+    unsigned int ScrubThreshold;// rewrite a block once when this many pages needed correction, 0: off
+    unsigned int BootCopies;    // copies of the loader written from block 0 on
+    unsigned int user_choice;
+} SPINAND_OPT_Info;
+
+typedef struct NAND_OPT_Info {
+    unsigned int Verify;        // 1: read back every programmed block through the BCH engine
+    unsigned int BitflipThreshold;// move a block when a field needed this many corrections, 0: 3/4 of the ECC level
+    unsigned int BootCopies;    // copies of the loader written from block 0 on
+    unsigned int user_choice;
+} NAND_OPT_Info;
+
+typedef struct EMMC_OPT_Info {
+    unsigned int BootPartition; // 1: loader into the BOOT0 and BOOT1 partitions instead of the user area
+    unsigned int BootUser;      // 1: clear BOOT_PARTITION_ENABLE when the loader goes to the user area
+    unsigned int SkipSame;      // 1: read user images back and write only the chunks that differ
+    unsigned int user_choice;
+} EMMC_OPT_Info;
+
 //----- Boot Code Optional Setting
 typedef struct IBR_boot_optional_pairs_struct_t {
     unsigned int  address;
@@ -113,6 +147,9 @@ typedef struct INI_Info {
     EMMC_FORMAT_Info EMMC_Format;
     unsigned int Loader_size;
     ERASE_Info Erase;
+    SPINAND_OPT_Info SpiNand;
+    NAND_OPT_Info Nand;
+    EMMC_OPT_Info Emmc;
 } INI_INFO_T;
 
 /* extern parameters */